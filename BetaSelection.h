@@ -0,0 +1,257 @@
+#ifndef BETASELECTION_H
+#define BETASELECTION_H
+
+#include <immintrin.h>
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Batched beta cuts for event cache columns. Every cut in BiPo::FillBeta is evaluated for a whole run's worth of betas
+// at once and the indices of the survivors are written out, eight candidates per step with AVX2 when the CPU has it and
+// one at a time otherwise. Both versions do the same float arithmetic in the same order as the scalar fill, so they
+// select the same betas. Both can also count the candidates each cut rejected, taking the cuts in FillBeta's order.
+
+// Cut values for one time window
+struct BetaWindowCuts
+{
+    float lowEnergy, highEnergy;
+    float lowPSD, highPSD;
+    float maxZ;  // |beta z|
+    float maxDz;  // |alpha z - beta z|, infinite when there's no cut
+    float maxDisplacement;
+    float timeStart, timeEnd;
+    std::array<std::int32_t, 256> rejectSegment;  // Nonzero for segments outside the fiducial volume
+};
+
+// Contiguous beta columns, with the values of each beta's alpha spread out alongside
+struct BetaBatch
+{
+    std::size_t size;
+    std::uint8_t const* segment;
+    float const* energy;
+    float const* psd;
+    float const* z;
+    float const* deltaTime;
+    std::int32_t const* alphaSegment;  // Negative when the alpha failed its own cuts
+    float const* alphaZ;
+};
+
+namespace BetaSelection
+{
+// Segment pitch times the row or column difference, rounded the way FillBeta rounds it
+constexpr int maxOffset = 18;
+
+inline std::array<float, 2 * maxOffset + 1> const offsetTable = []()
+{
+    std::array<float, 2 * maxOffset + 1> table{};
+
+    for (int k = -maxOffset; k <= maxOffset; k++)
+    {
+        table[k + maxOffset] = 145.7 * k;
+    }
+
+    return table;
+}();
+
+// Cuts in the order they're applied, what a beta failed first. Betas of rejected alphas aren't candidates at all
+enum Stage
+{
+    AlphaFailed = -1,
+    Segment = 0,
+    Z,
+    Dz,
+    Energy,
+    PSD,
+    Displacement,
+    Time,
+    Passed,
+    stages = Passed
+};
+
+// Row of a segment, exact for every uint8 segment number
+inline int Row(int segment)
+{
+    return (segment * 2341) >> 15;
+}
+
+inline int FailedStage(BetaBatch const& batch, BetaWindowCuts const& cuts, std::size_t i)
+{
+    int betaSegment = batch.segment[i];
+    int alphaSegment = batch.alphaSegment[i];
+
+    if (alphaSegment < 0)
+        return AlphaFailed;
+
+    if (cuts.rejectSegment[betaSegment])
+        return Segment;
+
+    float energy = batch.energy[i], psd = batch.psd[i], z = batch.z[i];
+
+    if (std::abs(z) > cuts.maxZ)
+        return Z;
+
+    int alphaY = Row(alphaSegment), betaY = Row(betaSegment);
+    int alphaX = alphaSegment - 14 * alphaY, betaX = betaSegment - 14 * betaY;
+
+    float dx = offsetTable[alphaX - betaX + maxOffset];
+    float dy = offsetTable[alphaY - betaY + maxOffset];
+    float dz = batch.alphaZ[i] - z;
+
+    float displacement = std::sqrt(dx * dx + dy * dy + dz * dz);
+
+    if (std::abs(dz) > cuts.maxDz)
+        return Dz;
+
+    if (energy < cuts.lowEnergy || energy > cuts.highEnergy)
+        return Energy;
+
+    if (psd < cuts.lowPSD || psd > cuts.highPSD)
+        return PSD;
+
+    if (displacement > cuts.maxDisplacement)
+        return Displacement;
+
+    float deltaTime = batch.deltaTime[i];
+
+    if (!(deltaTime > cuts.timeStart && deltaTime < cuts.timeEnd))
+        return Time;
+
+    return Passed;
+}
+
+inline bool Passes(BetaBatch const& batch, BetaWindowCuts const& cuts, std::size_t i)
+{
+    return FailedStage(batch, cuts, i) == Passed;
+}
+
+// rejected, when given, has one counter per stage and is added to
+inline std::size_t SelectScalar(BetaBatch const& batch, BetaWindowCuts const& cuts, std::uint32_t* selected,
+                                std::size_t* rejected = nullptr, std::size_t first = 0)
+{
+    std::size_t count = 0;
+
+    for (std::size_t i = first; i < batch.size; i++)
+    {
+        int stage = FailedStage(batch, cuts, i);
+
+        if (stage == Passed)
+            selected[count++] = i;
+        else if (rejected && stage != AlphaFailed)
+            rejected[stage]++;
+    }
+
+    return count;
+}
+
+// Narrows the passing lanes by one cut, counting the lanes it took out
+__attribute__((target("avx2"))) inline __m256 Narrow(__m256 pass, __m256 stagePass, std::size_t* rejected, int stage)
+{
+    __m256 narrowed = _mm256_and_ps(pass, stagePass);
+
+    if (rejected)
+        rejected[stage] += __builtin_popcount(_mm256_movemask_ps(pass) & ~_mm256_movemask_ps(narrowed));
+
+    return narrowed;
+}
+
+// Compiled for AVX2 only, no FMA, so the products and sums round exactly like the scalar code
+__attribute__((target("avx2"))) inline std::size_t SelectAVX2(BetaBatch const& batch,
+                                                               BetaWindowCuts const& cuts,
+                                                               std::uint32_t* selected,
+                                                               std::size_t* rejected = nullptr)
+{
+    __m256 const absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    __m256 const lowEnergy = _mm256_set1_ps(cuts.lowEnergy), highEnergy = _mm256_set1_ps(cuts.highEnergy);
+    __m256 const lowPSD = _mm256_set1_ps(cuts.lowPSD), highPSD = _mm256_set1_ps(cuts.highPSD);
+    __m256 const maxZ = _mm256_set1_ps(cuts.maxZ), maxDz = _mm256_set1_ps(cuts.maxDz);
+    __m256 const maxDisplacement = _mm256_set1_ps(cuts.maxDisplacement);
+    __m256 const timeStart = _mm256_set1_ps(cuts.timeStart), timeEnd = _mm256_set1_ps(cuts.timeEnd);
+    __m256i const rowMultiplier = _mm256_set1_epi32(2341), fourteen = _mm256_set1_epi32(14);
+    __m256i const offsetShift = _mm256_set1_epi32(maxOffset);
+    __m256i const offsetMin = _mm256_setzero_si256(), offsetMax = _mm256_set1_epi32(2 * maxOffset);
+
+    std::size_t count = 0, i = 0;
+
+    for (; i + 8 <= batch.size; i += 8)
+    {
+        __m256i betaSegment
+            = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<__m128i const*>(batch.segment + i)));
+        __m256i alphaSegment = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(batch.alphaSegment + i));
+
+        // Rejected alphas, then segments outside the fiducial volume
+        __m256 pass = _mm256_castsi256_ps(_mm256_cmpgt_epi32(alphaSegment, _mm256_set1_epi32(-1)));
+        __m256i reject = _mm256_i32gather_epi32(cuts.rejectSegment.data(), betaSegment, 4);
+        pass = Narrow(pass, _mm256_castsi256_ps(_mm256_cmpeq_epi32(reject, _mm256_setzero_si256())), rejected, Segment);
+
+        // Written as "not rejected" so NaNs pass the same way they do in the scalar code
+        __m256 energy = _mm256_loadu_ps(batch.energy + i);
+        __m256 psd = _mm256_loadu_ps(batch.psd + i);
+        __m256 z = _mm256_loadu_ps(batch.z + i);
+
+        pass = Narrow(pass, _mm256_cmp_ps(_mm256_and_ps(z, absMask), maxZ, _CMP_NGT_UQ), rejected, Z);
+
+        // Segment rows and columns without integer division
+        __m256i alphaY = _mm256_srai_epi32(_mm256_mullo_epi32(alphaSegment, rowMultiplier), 15);
+        __m256i betaY = _mm256_srai_epi32(_mm256_mullo_epi32(betaSegment, rowMultiplier), 15);
+        __m256i alphaX = _mm256_sub_epi32(alphaSegment, _mm256_mullo_epi32(alphaY, fourteen));
+        __m256i betaX = _mm256_sub_epi32(betaSegment, _mm256_mullo_epi32(betaY, fourteen));
+
+        // Clamped so rejected alphas can't index outside the table
+        __m256i xIndex = _mm256_add_epi32(_mm256_sub_epi32(alphaX, betaX), offsetShift);
+        __m256i yIndex = _mm256_add_epi32(_mm256_sub_epi32(alphaY, betaY), offsetShift);
+        xIndex = _mm256_min_epi32(_mm256_max_epi32(xIndex, offsetMin), offsetMax);
+        yIndex = _mm256_min_epi32(_mm256_max_epi32(yIndex, offsetMin), offsetMax);
+
+        __m256 dx = _mm256_i32gather_ps(offsetTable.data(), xIndex, 4);
+        __m256 dy = _mm256_i32gather_ps(offsetTable.data(), yIndex, 4);
+        __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(batch.alphaZ + i), z);
+
+        __m256 displacement = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        displacement = _mm256_sqrt_ps(_mm256_add_ps(displacement, _mm256_mul_ps(dz, dz)));
+
+        pass = Narrow(pass, _mm256_cmp_ps(_mm256_and_ps(dz, absMask), maxDz, _CMP_NGT_UQ), rejected, Dz);
+        pass = Narrow(pass,
+                      _mm256_and_ps(_mm256_cmp_ps(energy, lowEnergy, _CMP_NLT_UQ),
+                                    _mm256_cmp_ps(energy, highEnergy, _CMP_NGT_UQ)),
+                      rejected, Energy);
+        pass = Narrow(pass,
+                      _mm256_and_ps(_mm256_cmp_ps(psd, lowPSD, _CMP_NLT_UQ), _mm256_cmp_ps(psd, highPSD, _CMP_NGT_UQ)),
+                      rejected, PSD);
+        pass = Narrow(pass, _mm256_cmp_ps(displacement, maxDisplacement, _CMP_NGT_UQ), rejected, Displacement);
+
+        __m256 deltaTime = _mm256_loadu_ps(batch.deltaTime + i);
+        pass = Narrow(pass,
+                      _mm256_and_ps(_mm256_cmp_ps(deltaTime, timeStart, _CMP_GT_OQ),
+                                    _mm256_cmp_ps(deltaTime, timeEnd, _CMP_LT_OQ)),
+                      rejected, Time);
+
+        // Writing out the surviving lanes in order
+        unsigned mask = _mm256_movemask_ps(pass);
+
+        while (mask)
+        {
+            selected[count++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+
+    return count + SelectScalar(batch, cuts, selected + count, rejected, i);
+}
+
+// Fills selected with the indices of the betas passing every cut and returns how many there are. With rejected, also
+// adds up how many candidates each stage rejected
+inline std::size_t Select(BetaBatch const& batch, BetaWindowCuts const& cuts, std::uint32_t* selected,
+                          std::size_t* rejected = nullptr)
+{
+    static bool const hasAVX2 = __builtin_cpu_supports("avx2");
+
+    if (hasAVX2)
+        return SelectAVX2(batch, cuts, selected, rejected);
+
+    return SelectScalar(batch, cuts, selected, rejected);
+}
+}  // namespace BetaSelection
+
+#endif
@@ -0,0 +1,201 @@
+#include "BiPo.h"
+#include "Formatting.h"
+#include "Timer.h"
+
+using std::cout, std::string;
+
+// Whole number of at least minimum for option, false with a usage message for anything else
+template <typename Integer>
+bool ReadCount(char const* option, char const* text, Integer minimum, Integer& value)
+{
+    std::istringstream stream(text);
+    Integer read;
+
+    if (!(stream >> read) || !stream.eof() || read < minimum)
+    {
+        cout << "Expected " << option << " <n> with n >= " << minimum << ", got: " << text << '\n';
+        return false;
+    }
+
+    value = read;
+
+    return true;
+}
+
+// Command line of the analysis. Everything it runs is in BiPoDirectionality.cc, which BiPoBenchmark links as well
+int main(int argc, char* argv[])
+{
+    // Ignoring warnings
+    gErrorIgnoreLevel = kError;
+
+    // Using command line arguments for verbosity control
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "-D")
+            DETECTOR_VERBOSITY = 1;
+        else if (string(argv[i]) == "-N")
+            NCOUNT_VERBOSITY = 1;
+        else if (string(argv[i]) == "-T" && i + 1 < argc)
+        {
+            if (!ReadCount("-T", argv[++i], 1, WORKER_COUNT))
+                return 1;
+        }
+        else if (string(argv[i]) == "-P" && i + 1 < argc)
+        {
+            if (!ReadCount("-P", argv[++i], 0, PREFETCH_DEPTH))
+                return 1;
+        }
+        else if (string(argv[i]) == "-I")
+            IO_VERBOSITY = 1;
+        else if (string(argv[i]) == "-R" && i + 1 < argc)
+        {
+            if (!ReadCount("-R", argv[++i], 0, TREE_CACHE_MB))
+                return 1;
+        }
+        else if (string(argv[i]) == "-S" && i + 1 < argc)
+            SKIM_FILE = argv[++i];
+        else if (string(argv[i]) == "-C" && i + 1 < argc)
+            CACHE_FILE = argv[++i];
+        else if (string(argv[i]) == "--shard" && i + 1 < argc)
+        {
+            if (std::sscanf(argv[++i], "%d/%d", &SHARD_INDEX, &SHARD_COUNT) != 2 || SHARD_COUNT < 1 || SHARD_INDEX < 0
+                || SHARD_INDEX >= SHARD_COUNT)
+            {
+                cout << "Expected --shard i/N with 0 <= i < N, got: " << argv[i] << '\n';
+                return 1;
+            }
+        }
+        else if (string(argv[i]) == "--merge" && i + 1 < argc)
+            MERGE_DIR = argv[++i];
+        else if (string(argv[i]) == "--profile")
+            Profiler::enabled = true;
+        else if (string(argv[i]) == "--profile-json" && i + 1 < argc)
+        {
+            Profiler::enabled = true;
+            PROFILE_JSON = argv[++i];
+        }
+        else if (string(argv[i]) == "-K" && i + 1 < argc)
+            RUN_CACHE_DIR = argv[++i];
+        else if (string(argv[i]) == "-F" && i + 1 < argc)
+            CONFIG_FILE = argv[++i];
+        else if (string(argv[i]) == "-G" && i + 1 < argc)
+            CUT_GRID_FILE = argv[++i];
+        else if (string(argv[i]) == "-L" && i + 1 < argc)
+            LIST_SOURCES.push_back(argv[++i]);
+        else if (string(argv[i]) == "--prescan")
+            PRESCAN = true;
+        else if (string(argv[i]) == "--bootstrap" && i + 1 < argc)
+        {
+            if (!ReadCount("--bootstrap", argv[++i], 0, BOOTSTRAP_REPLICAS))
+                return 1;
+        }
+        else if (string(argv[i]) == "--jackknife" && i + 1 < argc)
+        {
+            if (!ReadCount("--jackknife", argv[++i], 0, JACKKNIFE_BLOCKS))
+                return 1;
+        }
+        else if (string(argv[i]) == "--slices" && i + 1 < argc)
+        {
+            string width = argv[++i];
+            std::istringstream stream(width);
+
+            if (width == "day")
+                SLICE_SECONDS = 86400;
+            else if (width == "week")
+                SLICE_SECONDS = 604800;
+            else if (!(stream >> SLICE_SECONDS) || !stream.eof())
+                SLICE_SECONDS = 0;
+
+            if (SLICE_SECONDS <= 0)
+            {
+                cout << "Expected --slices day, week or a width in seconds, got: " << width << '\n';
+                return 1;
+            }
+        }
+        else if (string(argv[i]) == "--energy-bins" && i + 1 < argc)
+            ENERGY_BINS = argv[++i];
+        else if (string(argv[i]) == "--displacement-bins" && i + 1 < argc)
+            DISPLACEMENT_BINS = argv[++i];
+        else if (string(argv[i]) == "--toys" && i + 1 < argc)
+        {
+            if (!ReadCount("--toys", argv[++i], 0ll, TOY_COUNT))
+                return 1;
+        }
+        else if (string(argv[i]) == "--singles" && i + 1 < argc)
+            SINGLES_FILE_NAME = argv[++i];
+    }
+
+    // Shard outputs only hold the totals, so the binned counts would be lost in the merge
+    if ((SHARD_COUNT > 0 || !MERGE_DIR.empty()) && (!ENERGY_BINS.empty() || !DISPLACEMENT_BINS.empty()))
+    {
+        cout << "Energy and displacement bins aren't kept in shard outputs, not binning with --shard or --merge.\n";
+        ENERGY_BINS = DISPLACEMENT_BINS = "";
+    }
+
+    // Histograms are owned by the class, not by whichever file is open
+    TH1::AddDirectory(kFALSE);
+
+    if (WORKER_COUNT > 1 || PREFETCH_DEPTH > 0 || SeparateRunCounts() || !ENERGY_BINS.empty()
+        || !DISPLACEMENT_BINS.empty())
+        ROOT::EnableThreadSafety();
+
+    // Timing everything
+    Timer timer(PROFILE_JSON);
+
+    // Filling detector configuration
+    PrintDetectorConfig();
+
+    // Setting up directionality class
+    BiPo directionality;
+
+    if (!CONFIG_FILE.empty())
+        directionality.ReadConfig();
+
+    if (!CUT_GRID_FILE.empty())
+        directionality.ReadCutGrid();
+
+    // Running analysis
+    if (!MERGE_DIR.empty())
+    {
+        if (!directionality.MergeShards())
+            return 1;
+
+        directionality.PrintCutFlow();
+    }
+    else
+    {
+        if (CACHE_FILE.empty())
+            directionality.ReadFileList();
+        else
+            directionality.ReadEventCache();
+
+        directionality.SetUpHistograms();
+
+        if (!SKIM_FILE.empty())
+            directionality.WriteEventCache();
+
+        directionality.PrintCutFlow();
+
+        // Shards stop at their raw counts, the background subtraction and angles wait for the merge
+        if (SHARD_COUNT > 0)
+        {
+            directionality.WriteShard();
+            return 0;
+        }
+    }
+
+    directionality.RunCutScan();
+
+    directionality.SubtractBackgrounds();
+    directionality.CalculateUnbiasing();
+    directionality.CalculateAngles();
+    directionality.OffsetTheta();
+    directionality.PrintAngles();
+    directionality.Resample();
+    directionality.AnalyzeSlices();
+    directionality.AnalyzeBins();
+    directionality.ValidateUnbiasing();
+    directionality.FillOutputFile();
+
+    return 0;
+}
@@ -1,21 +1,94 @@
+#ifndef BIPO_H
+#define BIPO_H
+
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
 #include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <set>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "Math/MinimizerOptions.h"
+#include "TBranch.h"
 #include "TF1.h"
 #include "TFile.h"
 #include "TH1D.h"
 #include "TH1I.h"
 #include "TLeaf.h"
+#include "TROOT.h"
 #include "TTree.h"
 
+#include "BetaSelection.h"
+#include "CoincidenceBuilder.h"
+#include "CutConfig.h"
+#include "DetectorConfig.h"
+#include "EventCache.h"
+#include "FileList.h"
+#include "FixedHistogram.h"
+#include "Resampling.h"
+#include "RunCache.h"
+#include "ToyMC.h"
+#include "Unbiasing.h"
+
 // Invariables
 #define pi 3.14159265358979323846
 
 // Print flags
-bool DETECTOR_VERBOSITY = 0;
-bool NCOUNT_VERBOSITY = 0;
+inline bool DETECTOR_VERBOSITY = 0;
+inline bool NCOUNT_VERBOSITY = 0;
+inline bool IO_VERBOSITY = 0;
+
+// Run options
+inline int WORKER_COUNT = 1;  // Number of threads reading files in SetUpHistograms
+inline int TREE_CACHE_MB = 32;  // TTreeCache size per file, 0 turns the cache off
+inline int PREFETCH_DEPTH = 0;  // Runs opened ahead of the fill by a reader thread, 0 reads synchronously
+inline std::string SKIM_FILE = "";  // Event cache written while reading the ROOT files
+inline std::string CACHE_FILE = "";  // Event cache read instead of the ROOT files
+inline int SHARD_INDEX = 0, SHARD_COUNT = 0;  // This job reads every SHARD_COUNT-th run starting at SHARD_INDEX, 0 reads all
+inline std::string PROFILE_JSON = "";  // Profile report written as JSON, --profile prints it either way
+inline std::string MERGE_DIR = "";  // Directory of shard outputs merged instead of reading any runs
+inline std::string RUN_CACHE_DIR = "";  // Directory of per-run partial counts reused by later jobs
+inline std::string CONFIG_FILE = "";  // Cuts, windows and data paths used instead of the defaults
+inline std::string CUT_GRID_FILE = "";  // Grid of cut values evaluated in the same pass as the nominal cuts
+inline std::vector<std::string> LIST_SOURCES;  // Run lists or globs given with -L, used instead of dataPath
+inline bool PRESCAN = false;  // Count the entries of every run before reading, for the progress estimate
+inline int BOOTSTRAP_REPLICAS = 0;  // Bootstrap replicas over runs evaluated after the nominal analysis, 0 turns it off
+inline int JACKKNIFE_BLOCKS = 0;  // Blocks of runs left out one at a time, at least the run count for leave-one-run-out
+inline std::string ENERGY_BINS = "";  // Beta energy bins analyzed on their own, a number of bins or comma separated edges
+inline std::string DISPLACEMENT_BINS = "";  // Same for |displacement|, both empty turns the binning off
+inline long long SLICE_SECONDS = 0;  // Width of the time slices analyzed on their own besides the total, 0 turns them off
+inline long long TOY_COUNT = 0;  // Toys per direction and rate thrown to check the unbiasing errors, 0 turns it off
+inline std::string SINGLES_FILE_NAME = "";  // Singles files read instead of the plugin's BiPo trees, %s is the run name
+
+// The resampling modes keep the counts of every run in memory
+inline bool Resampling()
+{
+    return BOOTSTRAP_REPLICAS > 0 || JACKKNIFE_BLOCKS > 0;
+}
+
+// Runs are filled on their own first when their counts are needed apart from the total
+inline bool SeparateRunCounts()
+{
+    return Resampling() || SLICE_SECONDS > 0;
+}
+
+// Prints the live segments of every detector period when DETECTOR_VERBOSITY is on
+void PrintDetectorConfig();
 
 // Utilities for parameters
 
@@ -27,7 +100,7 @@ enum Directions
     DirectionSize
 };
 
-std::string AxisToString(int num)
+inline std::string AxisToString(int num)
 {
     std::string name;
 
@@ -57,7 +130,7 @@ enum Signals
     SignalSize
 };
 
-std::string SignalToString(int num)
+inline std::string SignalToString(int num)
 {
     std::string name;
 
@@ -86,7 +159,7 @@ enum Datasets
     DatasetSize
 };
 
-std::string DatasetToString(int num)
+inline std::string DatasetToString(int num)
 {
     std::string name;
 
@@ -105,6 +178,136 @@ std::string DatasetToString(int num)
     return name;
 }
 
+// Cut flow stages in the order the cuts are applied. Each stage counts the candidates rejected there, the last one the
+// candidates passing every cut
+enum AlphaCuts
+{
+    AlphaFiducial = 0,
+    AlphaZ,
+    AlphaEnergy,
+    AlphaPSD,
+    AlphaPassed,
+    AlphaCutSize
+};
+
+inline std::string AlphaCutToString(int num)
+{
+    std::string name;
+
+    switch (num)
+    {
+        case 0:
+            name = "Fiducial";
+            break;
+        case 1:
+            name = "|z|";
+            break;
+        case 2:
+            name = "Energy";
+            break;
+        case 3:
+            name = "PSD";
+            break;
+        default:
+            name = "Passed";
+    }
+
+    return name;
+}
+
+enum BetaCuts
+{
+    BetaFiducial = 0,
+    BetaZ,
+    BetaCluster,
+    BetaDz,
+    BetaEnergy,
+    BetaPSD,
+    BetaDisplacement,
+    BetaTime,
+    BetaPassed,
+    BetaCutSize
+};
+
+inline std::string BetaCutToString(int num)
+{
+    std::string name;
+
+    switch (num)
+    {
+        case 0:
+            name = "Fiducial";
+            break;
+        case 1:
+            name = "|z|";
+            break;
+        case 2:
+            name = "Cluster multiplicity";
+            break;
+        case 3:
+            name = "|dz|";
+            break;
+        case 4:
+            name = "Energy";
+            break;
+        case 5:
+            name = "PSD";
+            break;
+        case 6:
+            name = "Displacement";
+            break;
+        case 7:
+            name = "Time window";
+            break;
+        default:
+            name = "Passed";
+    }
+
+    return name;
+}
+
+// Rejections per cut, for alphas and for the betas of the prompt and far windows
+struct CutFlow
+{
+    std::array<long long, AlphaCutSize> alpha{};
+    std::array<std::array<long long, BetaCutSize>, TotalDifference> beta{};
+
+    void Add(CutFlow const& other)
+    {
+        for (int cut = 0; cut < AlphaCutSize; cut++)
+        {
+            alpha[cut] += other.alpha[cut];
+        }
+
+        for (int signalSet = Correlated; signalSet < TotalDifference; signalSet++)
+        {
+            for (int cut = 0; cut < BetaCutSize; cut++)
+            {
+                beta[signalSet][cut] += other.beta[signalSet][cut];
+            }
+        }
+    }
+};
+
+// One beta candidate, taken straight from the tree branches or the event cache columns
+struct BetaCandidate
+{
+    int segment;
+    float energy;
+    float psd;
+    float z;
+    double deltaTime;  // alpha - beta for prompt, beta - alpha for far
+    bool clusterMatch;  // Cluster multiplicity equals ionization cluster multiplicity
+};
+
+// A ROOT run opened, possibly ahead of time by a prefetch thread. The tree is declared last so it goes before its file
+struct OpenedRun
+{
+    std::size_t run = 0;
+    std::unique_ptr<TFile> file;
+    std::shared_ptr<TTree> tree;
+};
+
 class BiPo
 {
   public:
@@ -115,20 +318,82 @@ class BiPo
     BiPo();
     void ReadFileList();
     void SetUpHistograms();
+    void ProcessRun(std::size_t run);
+    OpenedRun OpenRun(std::size_t run, bool prefetch) const;
+    void ProcessOpenedRun(OpenedRun& opened);
+    void ProcessSinglesRun(OpenedRun& opened);
+    CoincidenceWindows SinglesWindows() const;
+    void MergeHistograms(BiPo& worker);
+    std::vector<std::size_t> LoadPartials();
+    void WriteShard();
+    bool MergeShards();
+    std::uint64_t CutHash() const;
+    void PrintReadTotals();
+    void PrescanEntries();
+    void PrintProgress(std::size_t runsDone, std::size_t runCount, long long workDone, long long workTotal,
+                       double elapsed, int workerCount) const;
     void SetBranchAddresses(std::shared_ptr<TTree> rootTree);
     void FillHistogram();
-    void FillHistogramUnbiased(int signalSet);
+    void LoadCoincidence(Coincidence const& coincidence);
+    void FillCoincidence();
+    void FillBeta(int signalSet, int j, BetaCandidate const& beta);
+    void CalculateDisplacement(int betaSegment, float betaZ);
+    void FillSelected(int signalSet, int j, int betaSegment, std::size_t config, float betaEnergy);
+    void SkimEntry();
+    void SelectDetectorPeriod(std::string const& run);
+    void FillFromCache(std::size_t run);
+    void ReadEventCache();
+    void WriteEventCache();
+    bool PassAlphaCuts();
+    bool SetAlpha(int segment, double energy, double psd, double z);
+    void SetCutConfigs(std::vector<CutConfig> const& configs);
+    void SetRejectSegments();
+    void ReadConfig();
+    void ReadCutGrid();
+    void RunCutScan();
+    void PrintCutFlow();
     void CalculateUnbiasing();
+    void TransferCounts();
     void SubtractBackgrounds();
     void CalculateAngles();
     void OffsetTheta();
     void PrintAngles();
+    void Resample();
+    void AnalyzeSlices();
+    void SetUpBinning();
+    void AnalyzeBins();
+    void ValidateUnbiasing();
     void FillOutputFile();
 
     // Inline functions
     inline void ResetLineNumber() { lineNumber = 0; }
     inline void ResetLineCounter() { lineCounter = 0; }
     inline void ResetIndex() { index = 0; }
+    inline std::size_t RunCount() const { return eventCache ? eventCache->Runs() : files.size(); }
+    inline CutFlow const& NominalCutFlow() const { return counts[0].cutFlow; }
+    inline long BytesRead() const { return bytesRead; }
+
+    // Segment lookups of the per-candidate cuts, on the tables of the current run's detector period
+    inline SegmentInfo const& Segment(int segment) const { return (*segments)[segment]; }
+    inline bool FiducialCut(int segment) const { return Segment(segment).rejected; }
+
+    // Files and trees the runs are read from, the plugin's or the singles
+    inline std::string const& DataFileName() const
+    {
+        return SINGLES_FILE_NAME.empty() ? settings.dataFileName : SINGLES_FILE_NAME;
+    }
+
+    inline std::string RunPath(std::string const& run) const { return Form(DataFileName().c_str(), run.data()); }
+    inline char const* TreeName() const { return SINGLES_FILE_NAME.empty() ? "BiPoTreePlugin/BiPo" : "Singles"; }
+
+    // Expected amount of work in a run: alphas in the event cache, entries after a prescan, bytes on disk otherwise
+    inline long long RunWork(std::size_t run) const
+    {
+        if (eventCache)
+            return eventCache->runOffset[run + 1] - eventCache->runOffset[run];
+
+        return run < runWork.size() ? runWork[run] : 0;
+    }
 
   private:
     // Histogram to count IBDs
@@ -136,45 +401,118 @@ class BiPo
     std::array<std::array<TH1I, SignalSize>, DatasetSize> multiplicity;
 
     // File list
-    std::array<std::string, 1740> files;
+    std::vector<std::string> files;
+    std::vector<long long> runWork;
+
+    // Skimmed events, read from or written to an event cache
+    std::shared_ptr<MappedEventCache const> eventCache;
+    std::unique_ptr<EventCache> skimCache;
+
+    // Partial counts of runs read by earlier jobs
+    std::shared_ptr<RunCache const> runCache;
+
+    // Scratch space for the batched beta selection on cache runs, one set of window cuts per configuration
+    std::vector<std::array<BetaWindowCuts, TotalDifference>> windowCuts;
+    std::vector<std::int32_t> batchAlphaSegment;
+    std::vector<float> batchAlphaZ;
+    std::vector<std::uint32_t> selectedBetas;
 
     // Values grabbed from ROOT tree
-    double betaTime, deltaTime;
-    float betaEnergy, betaPSD;
     float dx, dy, dz, displacement;
-    float betaZ;
-    int betaSegment;
     int alphaX, alphaY;
     int betaX, betaY;
-    int multCluster, multClusterIoni;
     int dataSet;
     int direction;
     int lineNumber = 0, lineCounter = 0;
     int fillCount = 0;
+    long bytesRead = 0, readCalls = 0;
+    long unzippedBytes = 0, unzippedFullBytes = 0;  // Decompressed by the two phase read, and by reading whole entries
     std::size_t index = 0;
 
     // Invariables
-    static constexpr int xBins = 301;  // Number of bins for our histograms
-    static constexpr int zBins = 501;
-    static constexpr int totalDataLines = 1740;
-    static constexpr float xHistogramMax = 150.5;  // Maximum value of bin for histograms
-    static constexpr float zHistogramMax = 250.5;  // Maximum value of bin for histograms
     static constexpr float segmentWidth = 145.7;  // Distance between segment centers in mm
     static constexpr float atmosphericScaling = 1.000254;  // Atmosphering scaling coefficient
 
-    char const* dataPath = "2019XList_RxOff.txt";  // Reactor off dataset
-    char const* dataFileName = "/home/shay/Documents/PROSPECTData/BiPo_Data/%s/AD1_BiPo.root";
+    // Cuts, time windows, accidental weight and data location, defaults unless a config file was read
+    AnalysisConfig settings;
+
+    // What the fill loop writes to, copied into histogram and multiplicity by TransferCounts
+    struct SignalCounts
+    {
+        FixedHistogram<XAxis> x, y;
+        FixedHistogram<ZAxis> z;
+        FixedHistogram<MultiplicityAxis, long long> multiplicity;
+    };
+
+    // Everything one cut configuration fills, indexed by dataset like the histograms
+    struct CountSet
+    {
+        std::array<std::array<SignalCounts, TotalDifference>, DatasetSize> signals;
+        CutFlow cutFlow;
+
+        std::array<SignalCounts, TotalDifference>& operator[](int dataset) { return signals[dataset]; }
+        std::array<SignalCounts, TotalDifference> const& operator[](int dataset) const { return signals[dataset]; }
+    };
+
+    // Cut configurations filled in the same pass, the nominal cuts first and then any scan points
+    std::vector<CutConfig> cutConfigs;
+    std::vector<CountSet> counts;
+    std::vector<char> alphaPass;  // Whether the current alpha passes each configuration's alpha cuts
+    std::size_t activeConfig = 0;  // Configuration TransferCounts hands to the analysis
+    bool quiet = false;  // Skips the printouts while the scan points are analyzed
+    std::array<long long, BetaCutSize> uncountedBetas{};  // Cut flow of betas whose alpha failed the nominal cuts
+
+    // Nominal counts of every run on its own, kept for the resampling modes
+    using RunSignals = std::array<std::array<SignalCounts, TotalDifference>, DatasetSize>;
+    std::vector<std::size_t> partialRuns;
+    std::vector<RunSignals> runPartials;
+
+    static void AddCounts(std::vector<CountSet>& total, std::vector<CountSet> const& partial);
+    static void AddSignals(RunSignals& total, RunSignals const& partial, int times);
+    void FillSignals(RunSignals& target, int signalSet, int j, int betaSegment);
+    void FillHistogramUnbiased(int signalSet, RunSignals& target);
+    void KeepRunCounts(std::size_t run, std::vector<CountSet> const& runCounts);
+    std::vector<CountSet> SplitRunCounts();
+    void MergeRunCounts(std::size_t run, std::vector<CountSet>& totals);
+    void CountFileReads(TFile* file, std::string const& run, std::string const& detail);
+
+    // p_x, p_y, p_z, phi and theta of every dataset, for one replica of the runs
+    static constexpr int estimates = DirectionSize + 2;
+    using Estimates = std::array<std::array<double, estimates>, DatasetSize>;
+    Estimates EvaluateReplica(RunSignals const& replica, Estimates* errors = nullptr);
+    std::vector<Estimates> EvaluateParallel(std::size_t count, std::string const& name,
+                                            std::function<void(std::size_t, RunSignals&)> const& build,
+                                            std::vector<Estimates>* errors = nullptr);
+
+    // Nominal counts summed over the runs of every time slice that has any, keyed by slice number
+    struct Slice
+    {
+        RunSignals signals{};
+        int runs = 0;
+    };
+
+    std::map<long long, Slice> slices;
+    int unslicedRuns = 0;  // Runs without a timestamp, only in the total
+
+    // Nominal counts per beta energy and |displacement| bin, one flat block with the displacement bins innermost
+    std::vector<float> energyEdges, displacementEdges;
+    std::vector<RunSignals> binnedCounts;
+
+    // Bin of a selected beta in binnedCounts, -1 outside the edges
+    inline int BinnedCell(float energy, float distance) const
+    {
+        int energyBin = BinIndex(energyEdges, energy);
+        int distanceBin = BinIndex(displacementEdges, distance);
+
+        if (energyBin < 0 || distanceBin < 0)
+            return -1;
+
+        return energyBin * (displacementEdges.size() - 1) + distanceBin;
+    }
+
+    UnbiasingCounts UnbiasingInput(int signalSet, int direction) const;
 
-    // Cut values
-    static constexpr float highAlphaEnergy = 1.0, lowAlphaEnergy = 0.72;  // Alpha energy cut
-    static constexpr float highAlphaPSD = 0.34, lowAlphaPSD = 0.17;  // Alpha PSD cut
-    static constexpr float highBetaEnergy = 4.0, lowBetaEnergy = 0;  // Beta energy cut
-    static constexpr float highBetaPSD = 0.22, lowBetaPSD = 0.05;  // Beta PSD cut
-    static constexpr float n2f = 1 / 12.0;  // Accidental scaling weight
-    float tauBiPo = 0.1643 / log(2);  // BiPo lifetime
-    float timeStart = 0.01, timeEnd = 3 * tauBiPo;  // Time window for BiPo
-    float accTimeStart = 10 * tauBiPo;  // Accidental time window
-    float accTimeEnd = accTimeStart + 12 * (timeEnd - timeStart);
+    inline CutConfig NominalCuts() const { return settings.cuts; }
 
     // Storing final counts
     std::array<std::array<float, DirectionSize>, DatasetSize> mean;
@@ -184,13 +522,19 @@ class BiPo
     std::array<float, DatasetSize> theta;
     std::array<float, DatasetSize> thetaError;
 
-    // Utility functions
-    inline bool FiducialCut(int segment)
+    // Segment tables of the detector period the current run belongs to
+    SegmentTable const* segments = &detectorPeriods[0].segments;
+
+    // First alpha cut of a configuration that rejects this alpha, AlphaPassed if none does
+    static inline int AlphaCutFailed(CutConfig const& cuts, float energy, float psd)
     {
-        if (segment >= 140 || segment % 14 == 0 || (segment + 1) % 14 == 0 || segment == 25 || segment == 26)
-            return true;
-        else
-            return false;
+        if (energy < cuts.lowAlphaEnergy || energy > cuts.highAlphaEnergy)
+            return AlphaEnergy;
+
+        if (psd < cuts.lowAlphaPSD || psd > cuts.highAlphaPSD)
+            return AlphaPSD;
+
+        return AlphaPassed;
     }
 
     // Setting up the leafs
@@ -217,6 +561,12 @@ class BiPo
     Int_t multCorrelated;
     Int_t multAccidental;
 
+    // Branches read by FillHistogram, everything else in the tree is switched off
+    static constexpr std::array<char const*, 21> branchNames = {
+        "pseg", "pt", "pz", "pPSD", "pEtot", "pmult_clust", "pmult_clust_ioni",  // Prompt window
+        "fseg", "ft", "fz", "fPSD", "fEtot", "fmult_clust", "fmult_clust_ioni",  // Far window
+        "aseg", "aE", "at", "az",   "aPSD",  "mult_prompt", "mult_far"};  // Alpha
+
     // List of branches
     TBranch* b_pseg;
     TBranch* b_pt;
@@ -239,4 +589,47 @@ class BiPo
     TBranch* b_aPSD;
     TBranch* b_mult_prompt;
     TBranch* b_mult_far;
+
+    // Branches of the singles trees, one cluster per entry in time order
+    static constexpr std::array<char const*, 7> singlesBranchNames = {"t", "seg", "z", "E", "PSD", "mult_clust",
+                                                                      "mult_clust_ioni"};
+
+    // Prompt or far window of a coincidence built from singles, laid out like the plugin's branches so FillHistogram
+    // reads it through the same pointers
+    struct BuiltWindow
+    {
+        std::vector<int> segment, cluster, clusterIonization;
+        std::vector<double> time, z, psd, energy;
+
+        void Load(std::vector<SingleCluster> const& clusters)
+        {
+            segment.clear();
+            cluster.clear();
+            clusterIonization.clear();
+            time.clear();
+            z.clear();
+            psd.clear();
+            energy.clear();
+
+            for (SingleCluster const& single : clusters)
+            {
+                segment.push_back(single.segment);
+                cluster.push_back(single.cluster);
+                clusterIonization.push_back(single.clusterIonization);
+                time.push_back(single.time);
+                z.push_back(single.z);
+                psd.push_back(single.psd);
+                energy.push_back(single.energy);
+            }
+        }
+    };
+
+    BuiltWindow builtPrompt, builtFar;
+
+    // Entries are read in two phases: the alpha scalars of every entry, then the beta vectors only for entries whose
+    // alpha passed (or that go into the skim)
+    std::array<TBranch*, 7> alphaBranches{};
+    std::array<TBranch*, 14> betaBranches{};
 };
+
+#endif
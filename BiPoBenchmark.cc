@@ -0,0 +1,467 @@
+#include <map>
+#include <random>
+
+#include "TH1I.h"
+
+#include "BiPo.h"
+#include "Formatting.h"
+
+using std::cout, std::string, std::vector;
+
+// Rates of the analysis hot paths. Built together with BiPoDirectionality.cc, and only uses BiPo's public interface and
+// the header-only pieces it's made of.
+
+template <typename Function>
+double FillsPerSecond(std::size_t fills, Function fill)
+{
+    auto start = std::chrono::steady_clock::now();
+    fill();
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+    return fills / duration.count();
+}
+
+// Rates measured in this run, all of them higher is better
+std::map<string, double> results;
+volatile long long sink;  // Keeps results of the micro benchmarks alive
+
+void Report(string const& name, double rate, string const& unit)
+{
+    results[name] = rate;
+    cout << boldOn << name << ": " << resetFormats << rate / 1e6 << " M" << unit << "/s\n";
+}
+
+template <typename Histogram, typename Fixed>
+void Compare(string const& name, vector<double> const& values, double weight, Histogram& histogram, Fixed& fixed)
+{
+    double rootRate = FillsPerSecond(values.size(),
+                                     [&]()
+                                     {
+                                         for (double value : values)
+                                         {
+                                             histogram.Fill(value, weight);
+                                         }
+                                     });
+
+    double fixedRate = FillsPerSecond(values.size(),
+                                      [&]()
+                                      {
+                                          for (double value : values)
+                                          {
+                                              fixed.Fill(value, weight);
+                                          }
+                                      });
+
+    // Both paths have to agree bin for bin, up to TH1 adding the weight once per fill where FixedHistogram multiplies
+    bool same = histogram.GetEntries() == fixed.Entries();
+
+    for (int bin = 0; bin < Fixed::bins + 2; bin++)
+    {
+        double difference = std::abs(histogram.GetBinContent(bin) - fixed.BinContent(bin));
+        same = same && difference <= 1e-9 * std::abs(histogram.GetBinContent(bin));
+    }
+
+    results["TH1 fill " + name] = rootRate;
+    results["FixedHistogram fill " + name] = fixedRate;
+
+    cout << boldOn << name << ": " << resetFormats << rootRate / 1e6 << " M fills/s with TH1, " << fixedRate / 1e6
+         << " M fills/s with FixedHistogram (" << fixedRate / rootRate << "x), " << (same ? greenOn : redOn)
+         << (same ? "same contents" : "contents differ") << resetFormats << '\n';
+}
+
+void HistogramFills(std::size_t fills)
+{
+    // Values shaped like the real fills: neighbouring segment offsets in x and y, a wide spread in z
+    std::mt19937 generator(42);
+    std::normal_distribution<double> zSpread(0, 80);
+    std::uniform_int_distribution<int> segmentOffset(-1, 1);
+    std::uniform_int_distribution<int> windowPosition(1, 9);
+
+    vector<double> xValues(fills), zValues(fills), multiplicityValues(fills);
+
+    for (std::size_t i = 0; i < fills; i++)
+    {
+        xValues[i] = float(145.7 * segmentOffset(generator));
+        zValues[i] = float(zSpread(generator));
+        multiplicityValues[i] = windowPosition(generator);
+    }
+
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Histogram fills, " << fills << " per test.\n" << resetFormats;
+    cout << "--------------------------------------------\n";
+
+    for (double weight : {1.0, double(float(1 / 12.0))})
+    {
+        string label = (weight == 1) ? " (correlated)" : " (accidental)";
+
+        TH1D xHistogram("X", "X", XAxis::bins, XAxis::min, XAxis::max);
+        TH1D zHistogram("Z", "Z", ZAxis::bins, ZAxis::min, ZAxis::max);
+        TH1I multiplicityHistogram("Multiplicity", "Multiplicity", MultiplicityAxis::bins, MultiplicityAxis::min,
+                                   MultiplicityAxis::max);
+
+        FixedHistogram<XAxis> xFixed;
+        FixedHistogram<ZAxis> zFixed;
+        FixedHistogram<MultiplicityAxis, long long> multiplicityFixed;
+
+        Compare("X" + label, xValues, weight, xHistogram, xFixed);
+        Compare("Z" + label, zValues, weight, zHistogram, zFixed);
+        Compare("Multiplicity" + label, multiplicityValues, weight, multiplicityHistogram, multiplicityFixed);
+    }
+}
+
+// Segment lookups the per-candidate cuts make, through the BiPo members so each one goes via the current period's
+// table pointer
+void Segments(std::size_t calls)
+{
+    std::mt19937 generator(7);
+    std::uniform_int_distribution<int> anySegment(0, 153), innerSegment(15, 138);
+    vector<int> segments(calls), inner(calls);
+
+    for (std::size_t i = 0; i < calls; i++)
+    {
+        segments[i] = anySegment(generator);
+        inner[i] = innerSegment(generator);
+    }
+
+    BiPo bipo;
+    bipo.SelectDetectorPeriod("Benchmark_ts0");
+
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Segment lookups, " << calls << " per test.\n" << resetFormats;
+    cout << "--------------------------------------------\n";
+
+    Report("Segment fiducial lookup", FillsPerSecond(calls,
+                                                     [&]()
+                                                     {
+                                                         long long rejected = 0;
+
+                                                         for (int segment : segments)
+                                                         {
+                                                             rejected += bipo.FiducialCut(segment);
+                                                         }
+
+                                                         sink = rejected;
+                                                     }),
+           " calls");
+
+    // Four directions per call, like FillHistogramUnbiased
+    Report("Segment neighbour lookup", FillsPerSecond(calls,
+                                                      [&]()
+                                                      {
+                                                          long long live = 0;
+
+                                                          for (int segment : inner)
+                                                          {
+                                                              SegmentInfo const& info = bipo.Segment(segment);
+                                                              live += info.Neighbor(NeighborRight) + info.Neighbor(NeighborLeft)
+                                                                      + info.Neighbor(NeighborUp) + info.Neighbor(NeighborDown);
+                                                          }
+
+                                                          sink = live;
+                                                      }),
+           " calls");
+}
+
+// Alpha and beta of one candidate pair
+struct Candidate
+{
+    int alphaSegment;
+    float alphaZ;
+    BetaCandidate beta;
+};
+
+// Times SetAlpha and FillBeta over the candidates, the way FillHistogram calls them
+double FillRate(BiPo& bipo, int signalSet, vector<Candidate> const& candidates, CutConfig const& cuts)
+{
+    double alphaEnergy = (cuts.lowAlphaEnergy + cuts.highAlphaEnergy) / 2;
+    double alphaPSD = (cuts.lowAlphaPSD + cuts.highAlphaPSD) / 2;
+
+    return FillsPerSecond(candidates.size(),
+                          [&]()
+                          {
+                              for (std::size_t i = 0; i < candidates.size(); i++)
+                              {
+                                  Candidate const& candidate = candidates[i];
+
+                                  bipo.SetAlpha(candidate.alphaSegment, alphaEnergy, alphaPSD, candidate.alphaZ);
+                                  bipo.FillBeta(signalSet, i % 9, candidate.beta);
+                              }
+                          });
+}
+
+// Beta candidates around fiducial alphas, with the spread of values the cuts see in data
+void Candidates(std::size_t count)
+{
+    std::mt19937 generator(11);
+    std::uniform_int_distribution<int> segment(0, 153), neighbour(-1, 1);
+    std::uniform_real_distribution<float> energy(0, 5), psd(0, 0.4), z(-1100, 1100), time(0, 12);
+    std::bernoulli_distribution clusterMatch(0.97);
+
+    SegmentTable const& table = detectorPeriods[0].segments;
+    CutConfig const cuts = AnalysisConfig().cuts;
+    vector<Candidate> candidates(count), sameSegment(count);
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        Candidate& candidate = candidates[i];
+
+        do
+        {
+            candidate.alphaSegment = segment(generator);
+        } while (table[candidate.alphaSegment].rejected);
+
+        int betaSegment = candidate.alphaSegment + neighbour(generator) + 14 * neighbour(generator);
+        candidate.alphaZ = z(generator) * 0.9f;
+        candidate.beta = BetaCandidate{betaSegment, energy(generator), psd(generator), candidate.alphaZ + z(generator) / 8,
+                                       time(generator), clusterMatch(generator)};
+
+        // Betas passing every cut in the alpha's own segment, so each one also goes through FillHistogramUnbiased
+        sameSegment[i] = candidate;
+        sameSegment[i].beta = BetaCandidate{candidate.alphaSegment,
+                                            (cuts.lowBetaEnergy + cuts.highBetaEnergy) / 2,
+                                            (cuts.lowBetaPSD + cuts.highBetaPSD) / 2,
+                                            candidate.alphaZ + z(generator) / 100,
+                                            (cuts.timeStart + cuts.timeEnd) / 2,
+                                            true};
+    }
+
+    BiPo bipo;
+
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Fill paths, " << count << " candidates per test.\n" << resetFormats;
+    cout << "--------------------------------------------\n";
+
+    for (int signalSet = Correlated; signalSet < TotalDifference; signalSet++)
+    {
+        Report("FillBeta " + SignalToString(signalSet), FillRate(bipo, signalSet, candidates, cuts), " candidates");
+    }
+
+    // Same candidates with the nominal counts also kept in 8 x 8 beta energy and displacement bins
+    ENERGY_BINS = DISPLACEMENT_BINS = "8";
+    bipo.SetUpBinning();
+
+    Report("FillBeta Correlated binned", FillRate(bipo, Correlated, candidates, cuts), " candidates");
+
+    ENERGY_BINS = DISPLACEMENT_BINS = "";
+    bipo.SetUpBinning();
+
+    Report("FillBeta same segment", FillRate(bipo, Correlated, sameSegment, cuts), " candidates");
+}
+
+// Alphas read from the ROOT files, every alpha ends up in exactly one cut flow entry
+long long Alphas(BiPo const& bipo)
+{
+    long long alphas = 0;
+
+    for (long long count : bipo.NominalCutFlow().alpha)
+    {
+        alphas += count;
+    }
+
+    return alphas;
+}
+
+void Files(int runs)
+{
+    BiPo bipo;
+
+    if (!CONFIG_FILE.empty())
+        bipo.ReadConfig();
+
+    bipo.ReadFileList();
+    runs = std::min<int>(runs, bipo.RunCount());
+
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Single file reads, first " << runs << " runs.\n" << resetFormats;
+    cout << "--------------------------------------------\n";
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int run = 0; run < runs; run++)
+    {
+        bipo.ProcessRun(run);
+    }
+
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+    Report("File read alphas", Alphas(bipo) / duration.count(), " alphas");
+    Report("File read bytes", bipo.BytesRead() / duration.count(), "B");
+}
+
+// Whole pass over the file list at every thread count up to maxThreads, doubling each time
+void EndToEnd(int maxThreads)
+{
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "End to end passes.\n" << resetFormats;
+    cout << "--------------------------------------------\n";
+
+    vector<int> threadCounts;
+
+    for (int threads = 1; threads < maxThreads; threads *= 2)
+    {
+        threadCounts.push_back(threads);
+    }
+
+    threadCounts.push_back(maxThreads);
+
+    for (int threads : threadCounts)
+    {
+        WORKER_COUNT = threads;
+
+        BiPo bipo;
+
+        if (!CONFIG_FILE.empty())
+            bipo.ReadConfig();
+
+        bipo.ReadFileList();
+
+        auto start = std::chrono::steady_clock::now();
+        bipo.SetUpHistograms();
+        std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+        string label = " (" + std::to_string(threads) + " threads)";
+        Report("End to end alphas" + label, Alphas(bipo) / duration.count(), " alphas");
+        Report("End to end bytes" + label, bipo.BytesRead() / duration.count(), "B");
+    }
+
+    WORKER_COUNT = 1;
+}
+
+// Flat JSON object of rates, the format SaveBaseline writes
+std::map<string, double> ReadBaseline(string const& path)
+{
+    std::map<string, double> baseline;
+    std::ifstream file(path);
+    string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    std::size_t position = 0;
+
+    while ((position = text.find('"', position)) != string::npos)
+    {
+        std::size_t end = text.find('"', position + 1);
+        std::size_t colon = text.find(':', end);
+
+        if (end == string::npos || colon == string::npos)
+            break;
+
+        baseline[text.substr(position + 1, end - position - 1)] = std::strtod(text.c_str() + colon + 1, nullptr);
+        position = text.find_first_of(",}", colon);
+    }
+
+    return baseline;
+}
+
+void SaveBaseline(string const& path)
+{
+    std::ofstream file(path);
+    file << std::setprecision(10) << "{";
+
+    for (auto it = results.begin(); it != results.end(); it++)
+    {
+        file << (it == results.begin() ? "\n" : ",\n") << "  \"" << it->first << "\": " << it->second;
+    }
+
+    file << "\n}\n";
+
+    cout << boldOn << cyanOn << "Saved baseline: " << resetFormats << path << '\n';
+}
+
+// Returns the number of rates that dropped by more than threshold percent
+int CompareBaseline(string const& path, double threshold)
+{
+    std::map<string, double> baseline = ReadBaseline(path);
+    int regressions = 0;
+
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Compared to " << path << ", " << threshold << " % threshold.\n" << resetFormats;
+    cout << "--------------------------------------------\n";
+
+    for (auto const& [name, rate] : results)
+    {
+        auto old = baseline.find(name);
+
+        if (old == baseline.end() || old->second <= 0)
+        {
+            cout << yellowOn << boldOn << name << ": " << resetFormats << "no rate in the baseline\n";
+            continue;
+        }
+
+        double change = 100 * (rate / old->second - 1);
+        bool regressed = change < -threshold;
+        regressions += regressed;
+
+        if (regressed)
+            cout << redOn;
+        else if (change > threshold)
+            cout << greenOn;
+
+        cout << boldOn << name << ": " << resetFormats << std::showpos << change << std::noshowpos << " %";
+
+        if (regressed)
+            cout << redOn << " REGRESSION" << resetFormats;
+
+        cout << '\n';
+    }
+
+    // Rates the baseline has but this run didn't measure, e.g. the file benchmarks without -F
+    for (auto const& [name, rate] : baseline)
+    {
+        if (results.find(name) == results.end())
+            cout << yellowOn << boldOn << name << ": " << resetFormats << "not measured in this run\n";
+    }
+
+    return regressions;
+}
+
+int main(int argc, char* argv[])
+{
+    gErrorIgnoreLevel = kError;
+
+    std::size_t fills = 20000000;
+    int maxThreads = std::thread::hardware_concurrency(), runs = 10;
+    double threshold = 10;
+    string savePath, comparePath;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "-n" && i + 1 < argc)
+            fills = std::stoul(argv[++i]);
+        else if (string(argv[i]) == "-F" && i + 1 < argc)
+            CONFIG_FILE = argv[++i];
+        else if (string(argv[i]) == "-T" && i + 1 < argc)
+            maxThreads = std::stoi(argv[++i]);
+        else if (string(argv[i]) == "-r" && i + 1 < argc)
+            runs = std::stoi(argv[++i]);
+        else if (string(argv[i]) == "--save" && i + 1 < argc)
+            savePath = argv[++i];
+        else if (string(argv[i]) == "--compare" && i + 1 < argc)
+            comparePath = argv[++i];
+        else if (string(argv[i]) == "--threshold" && i + 1 < argc)
+            threshold = std::stod(argv[++i]);
+    }
+
+    TH1::AddDirectory(kFALSE);
+    ROOT::EnableThreadSafety();
+    PrintDetectorConfig();
+
+    HistogramFills(fills);
+    Segments(fills);
+    Candidates(fills / 4);
+
+    // The file benchmarks need data, see BiPoGenerator for a synthetic set
+    if (!CONFIG_FILE.empty())
+    {
+        Files(runs);
+        EndToEnd(std::max(maxThreads, 1));
+    }
+
+    cout << "--------------------------------------------\n";
+
+    if (!savePath.empty())
+        SaveBaseline(savePath);
+
+    if (!comparePath.empty() && CompareBaseline(comparePath, threshold) > 0)
+        return 1;
+
+    return 0;
+}
@@ -1,90 +1,67 @@
 #include "BiPo.h"
-#include "DetectorConfig.h"
 #include "Formatting.h"
 #include "Timer.h"
+#include "WorkQueue.h"
 
 using std::cout, std::string, std::ifstream, std::vector, std::array, std::getline;
 
-void FillDetectorConfig()
+void PrintDetectorConfig()
 {
-    // Filling values based on different periods
-
-    int noSegments = 154;
-
-    int excludeSize = excludeList.size();
-    int counter = 0, tmp = 0;
-
-    for (int j = 0; j < noSegments; j++)
-    {
-        // Filling live segments by checking exclude list
-        tmp = excludeList[counter];
-
-        if (j == tmp)
-        {
-            detectorConfig.push_back(0);
-            if (counter + 1 < excludeSize)
-            {
-                counter += 1;
-            }
-        }
-        else
-        {
-            detectorConfig.push_back(1);
-        }
-    }
+    // Live segments of every period come from the tables built at compile time in DetectorConfig.h
 
     if (DETECTOR_VERBOSITY)
     {
-        cout << "--------------------------------------------\n";
-        cout << "Below is the detector configuration.\n";
-        cout << "--------------------------------------------\n";
-
-        for (int j = 140; j >= 0; j -= 14)
+        for (DetectorPeriod const& period : detectorPeriods)
         {
-            for (int k = 0; k < 14; k++)
+            cout << "--------------------------------------------\n";
+            cout << "Below is the detector configuration from timestamp " << period.start << ".\n";
+            cout << "--------------------------------------------\n";
+
+            for (int j = 140; j >= 0; j -= 14)
             {
-                if (detectorConfig[j + k])
-                {
-                    cout << "\u25A0 ";
-                }
-                else
+                for (int k = 0; k < 14; k++)
                 {
-                    cout << "\u25A1 ";
+                    if (period.segments[j + k].live)
+                    {
+                        cout << "\u25A0 ";
+                    }
+                    else
+                    {
+                        cout << "\u25A1 ";
+                    }
                 }
-            }
 
-            cout << '\n';
+                cout << '\n';
+            }
         }
         cout << "--------------------------------------------\n";
     }
 }
 
-bool CheckNeighbor(int segment, char direction)
+// Timestamp from the ts in a run name like s001_f00002_ts1521215519, 0 if there isn't one
+long long RunTimestamp(string const& run)
 {
-    // Used for dead segment calculations
+    std::size_t position = run.rfind("_ts");
 
-    bool neighbor = false;
+    if (position == string::npos)
+        return 0;
 
-    switch (direction)
-    {
-        case 'r':
-            neighbor = detectorConfig[segment + 1];
-            break;
-        case 'l':
-            neighbor = detectorConfig[segment - 1];
-            break;
-        case 'u':
-            neighbor = detectorConfig[segment + 14];
-            break;
-        case 'd':
-            neighbor = detectorConfig[segment - 14];
-            break;
-        default:
-            cout << "That direction doesn't exist!\n";
-            return false;
-    }
+    return std::strtoll(run.c_str() + position + 3, nullptr, 10);
+}
+
+// Time slices are counted from Monday 1970-01-05, so days start at midnight UTC and weeks on Mondays
+constexpr long long sliceOrigin = 4 * 86400;
+
+string FormatTimestamp(long long timestamp)
+{
+    std::time_t time = timestamp;
+    std::tm utc;
+    gmtime_r(&time, &utc);
 
-    return neighbor;
+    char text[32];
+    std::strftime(text, sizeof(text), "%Y-%m-%d %H:%M", &utc);
+
+    return text;
 }
 
 BiPo::BiPo()
@@ -100,547 +77,2444 @@ BiPo::BiPo()
                 string axis = AxisToString(direction);
                 string histogramName = data + " " + signal + " " + axis;
 
-                int bins;
-                float histogramMax;
-
-                switch (direction)
-                {
-                    case X:
-                        bins = xBins;
-                        histogramMax = xHistogramMax;
-                        break;
-                    case Y:
-                        bins = xBins;
-                        histogramMax = xHistogramMax;
-                        break;
-                    case Z:
-                        bins = zBins;
-                        histogramMax = zHistogramMax;
-                        break;
-                    default:
-                        bins = xBins;
-                        histogramMax = xHistogramMax;
-                }
-
-                histogram[dataset][signalSet][direction]
-                    = TH1D(histogramName.c_str(), data.c_str(), bins, -histogramMax, histogramMax);
+                // Same axes the fill loop's FixedHistograms use
+                if (direction == Z)
+                    histogram[dataset][signalSet][direction]
+                        = TH1D(histogramName.c_str(), data.c_str(), ZAxis::bins, ZAxis::min, ZAxis::max);
+                else
+                    histogram[dataset][signalSet][direction]
+                        = TH1D(histogramName.c_str(), data.c_str(), XAxis::bins, XAxis::min, XAxis::max);
             }
 
             string data = DatasetToString(dataset);
             string signal = SignalToString(signalSet);
             string histogramName = "Multiplicity " + data + " " + signal;
 
-            int bins = 9;
-
-            multiplicity[dataset][signalSet] = TH1I(histogramName.c_str(), data.c_str(), bins, 1, bins);
+            multiplicity[dataset][signalSet] = TH1I(histogramName.c_str(), data.c_str(), MultiplicityAxis::bins,
+                                                    MultiplicityAxis::min, MultiplicityAxis::max);
         }
     }
 
+    SetCutConfigs({NominalCuts()});
+
+    if (!SKIM_FILE.empty())
+        skimCache = std::make_unique<EventCache>();
+
     ResetLineNumber();
 }
 
 void BiPo::ReadFileList()
 {
-    // Opening and checking file list
-    ifstream file;
-    file.open(dataPath, ifstream::in);
+    ProfileScope scope("Read file list");
 
-    if (!(file.is_open() && file.good()))
-    {
-        cout << "File list not found! Exiting.\n";
-        cout << "Trying to find: " << dataPath << '\n';
-        return;
-    }
+    // Lists given on the command line replace the ones in the config
+    vector<string> sources = LIST_SOURCES.empty() ? SplitSources(settings.dataPath) : LIST_SOURCES;
 
-    while (file.good() && getline(file, files[lineNumber]))
-    {
-        lineNumber++;
-    }
-}
+    files.clear();
 
-void BiPo::SetUpHistograms()
-{
-    while (index < files.size())
+    for (string const& source : sources)
     {
-        cout << "Reading file: " << lineCounter + 1 << "/" << totalDataLines << '\r';
-        cout.flush();
+        if (HasWildcard(source))
+        {
+            if (ExpandRunGlob(source, DataFileName(), files) == 0)
+                cout << "No runs match: " << source << '\n';
+        }
+        else if (!ReadRunList(source, files))
+        {
+            cout << "File list not found! Exiting.\n";
+            cout << "Trying to find: " << source << '\n';
+            files.clear();
+            return;
+        }
+    }
 
-        // Combining names into root file name
-        TString rootFilename = Form(dataFileName, files[index].data());
+    std::size_t duplicates = RemoveDuplicateRuns(files);
 
-        // Open the root file
-        auto rootFile = std::make_unique<TFile>(rootFilename);
+    // Looking for every ROOT file up front, a missing one would otherwise only show up once the workers reach it
+    vector<string> paths(files.size());
 
-        // Grab rootTree and cast to unique pointer
-        auto rootTree = std::shared_ptr<TTree>(static_cast<TTree*>(rootFile->Get("BiPoTreePlugin/BiPo")));
+    for (std::size_t run = 0; run < files.size(); run++)
+    {
+        paths[run] = RunPath(files[run]);
+    }
 
-        SetBranchAddresses(rootTree);
+    vector<long long> sizes = FileSizes(paths, std::max(WORKER_COUNT, 8));
+    vector<string> missing;
+    long long totalBytes = 0;
 
-        long nEntries = rootTree->GetEntries();
+    runWork.clear();
+    std::size_t kept = 0;
 
-        for (long i = 0; i < nEntries; i++)
+    for (std::size_t run = 0; run < files.size(); run++)
+    {
+        if (sizes[run] < 0)
         {
-            rootTree->GetEntry(i);
+            missing.push_back(paths[run]);
+            continue;
+        }
 
-            // Doing our own fiducial cut
-            if (FiducialCut(alphaSegment))
-                continue;
+        files[kept++] = files[run];
+        runWork.push_back(sizes[run]);
+        totalBytes += sizes[run];
+    }
 
-            // Applying alpha cuts
-            if (abs(alphaZ) > 1000)
-                continue;
+    files.resize(kept);
+    lineNumber = files.size();
 
-            if (alphaEnergy < lowAlphaEnergy || alphaEnergy > highAlphaEnergy)
-                continue;
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Run list: " << resetFormats << files.size() << " runs, " << totalBytes / 1073741824.0
+         << " GB from " << sources.size() << (sources.size() == 1 ? " source" : " sources");
 
-            if (alphaPSD < lowAlphaPSD || alphaPSD > highAlphaPSD)
-                continue;
+    if (duplicates > 0)
+        cout << ", " << duplicates << " duplicates dropped";
 
-            FillHistogram();
-        }
+    cout << '\n';
 
-        // rootFile->Close();
+    if (!missing.empty())
+    {
+        cout << redOn << boldOn << missing.size() << " ROOT files not found, skipping them:\n" << resetFormats;
 
-        lineCounter++;
-        index++;
-    }
-}
+        for (std::size_t i = 0; i < std::min<std::size_t>(missing.size(), 10); i++)
+        {
+            cout << "  " << missing[i] << '\n';
+        }
 
-void BiPo::SetBranchAddresses(std::shared_ptr<TTree> rootTree)
-{
-    // Set object pointer
-    pseg = 0;
-    pt = 0;
-    pz = 0;
-    pPSD = 0;
-    pEtot = 0;
-    pmult_clust = 0;
-    pmult_clust_ioni = 0;
-    fseg = 0;
-    ft = 0;
-    fz = 0;
-    fPSD = 0;
-    fEtot = 0;
-    fmult_clust = 0;
-    fmult_clust_ioni = 0;
+        if (missing.size() > 10)
+            cout << "  and " << missing.size() - 10 << " more\n";
+    }
 
-    // Set branch addresses and branch pointers
-    if (!rootTree)
-        return;
+    cout << "--------------------------------------------\n";
 
-    // Prompt Window
-    rootTree->SetBranchAddress("pseg", &pseg, &b_pseg);  // beta segment number
-    rootTree->SetBranchAddress("pt", &pt, &b_pt);  // beta timing in us
-    rootTree->SetBranchAddress("pz", &pz, &b_pz);  // beta position in Z position, given in mm
-    rootTree->SetBranchAddress("pPSD", &pPSD, &b_pPSD);  // beta PSD
-    rootTree->SetBranchAddress("pEtot", &pEtot, &b_pEtot);  // beta total energy in MeV
-    rootTree->SetBranchAddress("pmult_clust", &pmult_clust, &b_pmult_clust);  // prompt cluster
-                                                                              // multiplicity
-    rootTree->SetBranchAddress("pmult_clust_ioni", &pmult_clust_ioni, &b_pmult_clust_ioni);  // prompt cluster multiplicity
-                                                                                             // ionization?
-    // Far Window
-    rootTree->SetBranchAddress("fseg", &fseg, &b_fseg);  // beta segment number
-    rootTree->SetBranchAddress("ft", &ft, &b_ft);  // beta timing in us
-    rootTree->SetBranchAddress("fz", &fz, &b_fz);  // beta position in Z position, given in mm
-    rootTree->SetBranchAddress("fPSD", &fPSD, &b_fPSD);  // beta PSD
-    rootTree->SetBranchAddress("fEtot", &fEtot, &b_fEtot);  // beta total energy in MeV
-    rootTree->SetBranchAddress("fmult_clust", &fmult_clust, &b_fmult_clust);  // prompt cluster
-                                                                              // multiplicity
-    rootTree->SetBranchAddress("fmult_clust_ioni", &fmult_clust_ioni, &b_fmult_clust_ioni);  // prompt cluster multiplicity
-                                                                                             // ionization?
-    // Alpha
-    rootTree->SetBranchAddress("aseg", &alphaSegment, &b_aseg);  // alpha segment number
-    rootTree->SetBranchAddress("aE", &alphaEnergy, &b_aE);  // alpha energy in MeV
-    rootTree->SetBranchAddress("at", &alphaTime, &b_at);  // alpha timing in us
-    rootTree->SetBranchAddress("az", &alphaZ, &b_az);
-    rootTree->SetBranchAddress("aPSD", &alphaPSD, &b_aPSD);  // alpha PSD
-    rootTree->SetBranchAddress("mult_prompt", &multCorrelated, &b_mult_prompt);  // prompt
-                                                                                 // multiplicity for
-                                                                                 // correlated
-    rootTree->SetBranchAddress("mult_far", &multAccidental, &b_mult_far);  // prompt multiplicity
-                                                                           // for accidentals
+    if (PRESCAN)
+        PrescanEntries();
 }
 
-void BiPo::FillHistogram()
+void BiPo::PrescanEntries()
 {
-    for (int j = 0; j < multCorrelated; j++)
-    {
-        // Fiducial cut for beta
-        betaSegment = pseg->at(j);
-
-        if (FiducialCut(betaSegment))
-            continue;
+    ProfileScope scope("Prescan");
 
-        // Grabbing beta values
-        betaEnergy = pEtot->at(j);
-        betaPSD = pPSD->at(j);
-        betaZ = pz->at(j);
-        multCluster = pmult_clust->at(j);
-        multClusterIoni = pmult_clust_ioni->at(j);
+    // Only the tree header is read, so this costs one open per run
+    vector<long long> entries(files.size(), 0);
 
-        // Applying alpha cuts
-        if (abs(betaZ) > 1000)
-            continue;
+    ForEachParallel(files.size(), WORKER_COUNT,
+                    [&](std::size_t run)
+                    {
+                        TFile file(RunPath(files[run]).c_str());
+                        TTree* tree = file.Get<TTree>(TreeName());
 
-        if (betaEnergy < lowBetaEnergy || betaEnergy > highBetaEnergy)
-            continue;
+                        if (tree)
+                            entries[run] = tree->GetEntries();
+                    });
 
-        if (betaPSD < lowBetaPSD || betaPSD > highBetaPSD)
-            continue;
+    long long totalEntries = 0;
 
-        if (multCluster != multClusterIoni)
-            continue;
+    for (long long count : entries)
+    {
+        totalEntries += count;
+    }
 
-        // Alpha location
-        alphaX = alphaSegment % 14;
-        alphaY = alphaSegment / 14;
+    runWork = entries;
 
-        // Beta location
-        betaX = betaSegment % 14;
-        betaY = betaSegment / 14;
-        betaZ = pz->at(j);
+    cout << boldOn << cyanOn << "Prescan: " << resetFormats << totalEntries << " entries in " << files.size()
+         << " runs.\n";
+    cout << "--------------------------------------------\n";
+}
 
-        // Calculating prompt - delayed displacement
-        dx = 145.7 * (alphaX - betaX);
-        dy = 145.7 * (alphaY - betaY);
-        dz = alphaZ - betaZ;
+void BiPo::PrintProgress(std::size_t runsDone, std::size_t runCount, long long workDone, long long workTotal,
+                         double elapsed, int workerCount) const
+{
+    cout << "Reading file: " << runsDone << "/" << runCount;
 
-        displacement = sqrt(dx * dx + dy * dy + dz * dz);
+    if (workerCount > 1)
+        cout << " with " << workerCount << " threads";
 
-        if (displacement > 550)
-            continue;
+    // Time left from the share of the data done so far, not the share of runs
+    if (workDone > 0 && workTotal > 0)
+    {
+        double fraction = double(workDone) / workTotal;
+        cout << ", " << int(100 * fraction) << " %, " << int(elapsed * (1 - fraction) / fraction) << " s left";
+    }
 
-        betaTime = pt->at(j);
+    cout << "      \r";
+    cout.flush();
+}
 
-        deltaTime = alphaTime - betaTime;
+void BiPo::SetCutConfigs(vector<CutConfig> const& configs)
+{
+    cutConfigs = configs;
+    counts.assign(configs.size(), CountSet());
+    alphaPass.assign(configs.size(), 0);
+    windowCuts.resize(configs.size());
 
-        if (deltaTime > timeStart && deltaTime < timeEnd)
+    // Beta cuts for the batched cache fill, same values FillBeta uses
+    for (std::size_t config = 0; config < configs.size(); config++)
+    {
+        for (int signalSet = Correlated; signalSet < TotalDifference; signalSet++)
         {
-            if (alphaSegment == betaSegment + 1 || alphaSegment == betaSegment - 1)
-            {
-                histogram[Data][Correlated][X].Fill(dx);
-            }
+            BetaWindowCuts& cuts = windowCuts[config][signalSet];
+
+            cuts.lowEnergy = configs[config].lowBetaEnergy;
+            cuts.highEnergy = configs[config].highBetaEnergy;
+            cuts.lowPSD = configs[config].lowBetaPSD;
+            cuts.highPSD = configs[config].highBetaPSD;
+            cuts.maxZ = 1000;
+            cuts.maxDz = (signalSet == Accidental) ? 250 : std::numeric_limits<float>::infinity();
+            cuts.maxDisplacement = configs[config].maxDisplacement;
+            cuts.timeStart = (signalSet == Correlated) ? configs[config].timeStart : configs[config].accTimeStart;
+            cuts.timeEnd = (signalSet == Correlated) ? configs[config].timeEnd : configs[config].accTimeEnd;
+        }
+    }
 
-            if (alphaSegment == betaSegment + 14 || alphaSegment == betaSegment - 14)
-                histogram[Data][Correlated][Y].Fill(dy);
+    SetRejectSegments();
+}
 
-            if (alphaSegment == betaSegment)
+void BiPo::SetRejectSegments()
+{
+    for (auto& cuts : windowCuts)
+    {
+        for (BetaWindowCuts& windowCut : cuts)
+        {
+            for (int segment = 0; segment < (int)windowCut.rejectSegment.size(); segment++)
             {
-                histogram[Data][Correlated][X].Fill(0.0);
-                histogram[Data][Correlated][Y].Fill(0.0);
-                histogram[Data][Correlated][Z].Fill(dz);
-                FillHistogramUnbiased(Correlated);
+                windowCut.rejectSegment[segment] = FiducialCut(segment);
             }
-
-            multiplicity[Data][Correlated].Fill(j + 1);
         }
     }
+}
 
-    for (int j = 0; j < multAccidental; j++)
+void BiPo::ReadConfig()
+{
+    if (!ReadAnalysisConfig(CONFIG_FILE, settings))
     {
-        // Fiducial cut for beta
-        betaSegment = fseg->at(j);
+        cout << "Running with the default configuration.\n";
+        return;
+    }
 
-        if (FiducialCut(betaSegment))
-            continue;
+    SetCutConfigs({NominalCuts()});
 
-        // Grabbing beta values
-        betaEnergy = fEtot->at(j);
-        betaPSD = fPSD->at(j);
-        betaZ = fz->at(j);
-        multCluster = fmult_clust->at(j);
-        multClusterIoni = fmult_clust_ioni->at(j);
+    CutConfig const& cuts = settings.cuts;
 
-        // Applying alpha cuts
-        if (abs(betaZ) > 1000)
-            continue;
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Configuration from: " << resetFormats << CONFIG_FILE << '\n';
+    cout << "--------------------------------------------\n";
+    cout << boldOn << "Alpha energy: " << resetFormats << cuts.lowAlphaEnergy << " - " << cuts.highAlphaEnergy << '\n';
+    cout << boldOn << "Alpha PSD: " << resetFormats << cuts.lowAlphaPSD << " - " << cuts.highAlphaPSD << '\n';
+    cout << boldOn << "Beta energy: " << resetFormats << cuts.lowBetaEnergy << " - " << cuts.highBetaEnergy << '\n';
+    cout << boldOn << "Beta PSD: " << resetFormats << cuts.lowBetaPSD << " - " << cuts.highBetaPSD << '\n';
+    cout << boldOn << "Displacement: " << resetFormats << "< " << cuts.maxDisplacement << '\n';
+    cout << boldOn << "BiPo window: " << resetFormats << cuts.timeStart << " - " << cuts.timeEnd << '\n';
+    cout << boldOn << "Accidental window: " << resetFormats << cuts.accTimeStart << " - " << cuts.accTimeEnd << '\n';
+    cout << boldOn << "n2f: " << resetFormats << settings.n2f << '\n';
+    cout << boldOn << "Data: " << resetFormats << settings.dataPath << ", " << DataFileName() << '\n';
+    cout << "--------------------------------------------\n";
+}
 
-        if (betaEnergy < lowBetaEnergy || betaEnergy > highBetaEnergy)
-            continue;
+void BiPo::ReadCutGrid()
+{
+    vector<CutConfig> grid = ::ReadCutGrid(CUT_GRID_FILE, NominalCuts(), settings.n2f);
 
-        if (betaPSD < lowBetaPSD || betaPSD > highBetaPSD)
-            continue;
+    if (grid.empty())
+    {
+        cout << "Running without the cut scan.\n";
+        return;
+    }
 
-        if (multCluster != multClusterIoni)
-            continue;
+    // Nominal cuts stay first so the usual output is unchanged
+    vector<CutConfig> configs{NominalCuts()};
+    configs.insert(configs.end(), grid.begin(), grid.end());
+
+    SetCutConfigs(configs);
 
-        // Alpha location
-        alphaX = alphaSegment % 14;
-        alphaY = alphaSegment / 14;
+    cout << boldOn << cyanOn << "Cut scan: " << resetFormats << grid.size() << " configurations from " << CUT_GRID_FILE
+         << '\n';
+}
 
-        // Beta location
-        betaX = betaSegment % 14;
-        betaY = betaSegment / 14;
-        betaZ = fz->at(j);
+void BiPo::SetUpHistograms()
+{
+    ProfileScope scope("Set up histograms");
 
-        // Calculating prompt - delayed displacement
-        dx = 145.7 * (alphaX - betaX);
-        dy = 145.7 * (alphaY - betaY);
-        dz = alphaZ - betaZ;
+    SetUpBinning();
 
-        displacement = sqrt(dx * dx + dy * dy + dz * dz);
+    // Runs with an up to date partial from an earlier job are merged straight away and not read again
+    vector<std::size_t> pending = LoadPartials();
+    std::size_t runCount = pending.size();
+    int workerCount = std::min<int>(WORKER_COUNT, runCount);
 
-        if (abs(dz) > 250)
-            continue;
+    // Ordering runs by size on disk (or by entries or alphas when known) so the long background runs are started first
+    vector<std::size_t> runSizes(runCount, 0);
+    long long totalWork = 0;
 
-        if (displacement > 550)
-            continue;
+    for (std::size_t task = 0; task < runCount; task++)
+    {
+        runSizes[task] = RunWork(pending[task]);
+        totalWork += runSizes[task];
+    }
 
-        betaTime = ft->at(j);
+    auto start = std::chrono::steady_clock::now();
 
-        deltaTime = betaTime - alphaTime;
+    if (workerCount <= 1 && (PREFETCH_DEPTH == 0 || eventCache))
+    {
+        long long workDone = 0;
 
-        if (deltaTime > accTimeStart && deltaTime < accTimeEnd)
+        while (index < runCount)
         {
-            if (alphaSegment == betaSegment + 1 || alphaSegment == betaSegment - 1)
-                histogram[Data][Accidental][X].Fill(dx, n2f);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            PrintProgress(lineCounter + 1, runCount, workDone, totalWork, elapsed.count(), 1);
 
-            if (alphaSegment == betaSegment + 14 || alphaSegment == betaSegment - 14)
-                histogram[Data][Accidental][Y].Fill(dy, n2f);
+            ProcessRun(pending[index]);
+            workDone += runSizes[index];
 
-            if (alphaSegment == betaSegment)
-            {
-                histogram[Data][Accidental][X].Fill(0.0, n2f);
-                histogram[Data][Accidental][Y].Fill(0.0, n2f);
-                histogram[Data][Accidental][Z].Fill(dz, n2f);
-                FillHistogramUnbiased(Accidental);
-            }
-
-            multiplicity[Data][Accidental].Fill(j + 1, n2f);
+            lineCounter++;
+            index++;
         }
-    }
-}
-
-void BiPo::FillHistogramUnbiased(int signalSet)
-{
-    bool posDirectionX = false, negDirectionX = false;
-    bool posDirectionY = false, negDirectionY = false;
 
-    // Need to weight accidental datasets by deadtime correction factor
-    double weight = (signalSet == Accidental) ? n2f : 1;
+        PrintReadTotals();
 
-    // Check for live neighbors in different directions
-    posDirectionX = CheckNeighbor(alphaSegment, 'r');
-    negDirectionX = CheckNeighbor(alphaSegment, 'l');
-    posDirectionY = CheckNeighbor(alphaSegment, 'u');
-    negDirectionY = CheckNeighbor(alphaSegment, 'd');
+        return;
+    }
 
-    // Filling x axis
-    if (posDirectionX && !negDirectionX)
-        histogram[DataUnbiased][signalSet][X].Fill(segmentWidth, weight);
-    else if (!posDirectionX && negDirectionX)
-        histogram[DataUnbiased][signalSet][X].Fill(-segmentWidth, weight);
-    else if (posDirectionX && negDirectionX)
-        histogram[DataUnbiased][signalSet][X].Fill(0.0, weight);
+    WorkQueue queue(runSizes, workerCount);
 
-    // Filling y axis
-    if (posDirectionY && !negDirectionY)
-        histogram[DataUnbiased][signalSet][Y].Fill(segmentWidth, weight);
-    else if (!posDirectionY && negDirectionY)
-        histogram[DataUnbiased][signalSet][Y].Fill(-segmentWidth, weight);
-    else if (posDirectionY && negDirectionY)
-        histogram[DataUnbiased][signalSet][Y].Fill(0.0, weight);
+    // Each worker owns its own tree, branch buffers and histograms
+    vector<std::unique_ptr<BiPo>> workers;
+    vector<std::thread> threads;
+    vector<double> busyTime(workerCount, 0);
+    vector<int> runsRead(workerCount, 0);
+    std::atomic<int> filesDone = 0;
+    std::atomic<long long> workDone = 0;
 
-    // Filling z axis
-    histogram[DataUnbiased][signalSet][Z].Fill(dz, weight);
-}
+    for (int worker = 0; worker < workerCount; worker++)
+    {
+        workers.push_back(std::make_unique<BiPo>());
+        workers.back()->settings = settings;
+        workers.back()->files = files;
+        workers.back()->SetCutConfigs(cutConfigs);
+        workers.back()->eventCache = eventCache;
+        workers.back()->runCache = runCache;
+        workers.back()->energyEdges = energyEdges;
+        workers.back()->displacementEdges = displacementEdges;
+        workers.back()->binnedCounts.resize(binnedCounts.size());
+    }
 
-void BiPo::SubtractBackgrounds()
-{
-    for (int dataset = Data; dataset < DatasetSize; dataset++)
+    for (int worker = 0; worker < workerCount; worker++)
     {
-        for (int direction = X; direction < DirectionSize; direction++)
-        {
-            string histogramName;
-            string data = DatasetToString(dataset);
-            histogramName = data + " Total Difference " + AxisToString(direction);
+        threads.emplace_back(
+            [this, &workers, &queue, &pending, &runSizes, &busyTime, &runsRead, &filesDone, &workDone, worker]()
+            {
+                Profiler::Get().NameThread("Worker " + std::to_string(worker));
+                std::size_t task;
 
-            // Copying Correlated to start
-            histogram[dataset][TotalDifference][direction] = TH1D(histogram[dataset][Correlated][direction]);
+                if (PREFETCH_DEPTH == 0 || eventCache)
+                {
+                    while (queue.Pop(worker, task))
+                    {
+                        auto runStart = std::chrono::steady_clock::now();
 
-            histogram[dataset][TotalDifference][direction].SetNameTitle(histogramName.c_str(), data.c_str());
+                        workers[worker]->ProcessRun(pending[task]);
 
-            histogram[dataset][TotalDifference][direction].Add(&histogram[dataset][Accidental][direction], -1.0);
+                        std::chrono::duration<double> runTime = std::chrono::steady_clock::now() - runStart;
+                        busyTime[worker] += runTime.count();
+                        runsRead[worker]++;
+                        workDone += runSizes[task];
+                        filesDone++;
+                    }
 
-            if (dataset == DataUnbiased || direction == Z)
-                continue;
+                    return;
+                }
 
-            mean[dataset][direction] = histogram[dataset][TotalDifference][direction].GetMean();
+                // A reader thread opens this worker's upcoming runs and loads their baskets while we fill
+                BoundedQueue<OpenedRun> prefetched(PREFETCH_DEPTH);
 
-            float effEntries = histogram[dataset][TotalDifference][direction].GetEntries();
-            sigma[dataset][direction] = histogram[dataset][TotalDifference][direction].GetStdDev() / sqrt(effEntries);
-        }
+                std::thread reader(
+                    [&workers, &queue, &pending, &prefetched, worker]()
+                    {
+                        Profiler::Get().NameThread("Reader " + std::to_string(worker));
+                        std::size_t next;
 
-        // Z is fit to a Guassian and only takes same segment inputs
-        // Possible thanks to 1mm resolution in Z
-        TF1 gaussian("Fit", "gaus", -250, 250);
+                        while (queue.Pop(worker, next))
+                        {
+                            prefetched.Push(workers[worker]->OpenRun(pending[next], true));
+                        }
 
-        histogram[dataset][TotalDifference][Z].Fit("Fit", "RQ");
+                        prefetched.Close();
+                    });
 
-        float zMean = gaussian.GetParameter(1);
-        float zError = gaussian.GetParError(1);
+                OpenedRun opened;
 
-        mean[dataset][Z] = zMean;
-        sigma[dataset][Z] = zError;
+                while (prefetched.Pop(opened))
+                {
+                    auto runStart = std::chrono::steady_clock::now();
 
-        // Deleting fit because we don't want the plot options stuck here
-        delete histogram[dataset][TotalDifference][Z].GetListOfFunctions()->FindObject("Fit");
+                    workers[worker]->ProcessOpenedRun(opened);
+                    workDone += RunWork(opened.run);
+                    opened = OpenedRun();
 
-        // Multiplicity background subtraction
-        string histogramName;
-        string data = DatasetToString(dataset);
-        histogramName = "Multiplicity " + data + " Total Difference";
+                    std::chrono::duration<double> runTime = std::chrono::steady_clock::now() - runStart;
+                    busyTime[worker] += runTime.count();
+                    runsRead[worker]++;
+                    filesDone++;
+                }
 
-        multiplicity[dataset][TotalDifference] = TH1I(multiplicity[dataset][Correlated]);
-        multiplicity[dataset][TotalDifference].SetNameTitle(histogramName.c_str(), data.c_str());
-        multiplicity[dataset][TotalDifference].Add(&multiplicity[dataset][Accidental], -1.0);
+                reader.join();
+            });
     }
-}
 
-void BiPo::CalculateUnbiasing()
-{
-    // Defining variables used in calculation. Check the error propagation technote for details on
-    // the method
-    double rPlus = 0, rMinus = 0;
-    double p = 0, pError = 0;
-    double nPlus = 0, nPlusPlus = 0, nMinus = 0, nMinusMinus = 0, nPlusMinus = 0;
-    double nPlusError = 0, nPlusPlusError = 0, nMinusError = 0, nMinusMinusError = 0, nPlusMinusError = 0;
+    // Printing progress from the main thread while the workers read
+    while (filesDone < (int)runCount)
+    {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        PrintProgress(filesDone, runCount, workDone, totalWork, elapsed.count(), workerCount);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
 
-    for (int direction = X; direction < Z; direction++)
+    for (auto& thread : threads)
     {
-        // Grabbing data from filled bins, rest should be empty
-        nPlus = histogram[Data][TotalDifference][direction].GetBinContent(297);
-        nPlusPlus = histogram[DataUnbiased][TotalDifference][direction].GetBinContent(297);
-        nMinus = histogram[Data][TotalDifference][direction].GetBinContent(5);
-        nMinusMinus = histogram[DataUnbiased][TotalDifference][direction].GetBinContent(5);
-        nPlusMinus = histogram[DataUnbiased][TotalDifference][direction].GetBinContent(151);
-
-        nPlusError = histogram[Data][TotalDifference][direction].GetBinError(297);
-        nPlusPlusError = histogram[DataUnbiased][TotalDifference][direction].GetBinError(297);
-        nMinusError = histogram[Data][TotalDifference][direction].GetBinError(5);
-        nMinusMinusError = histogram[DataUnbiased][TotalDifference][direction].GetBinError(5);
-        nPlusMinusError = histogram[DataUnbiased][TotalDifference][direction].GetBinError(151);
-
-        rPlus = nPlus / (nPlusPlus + nPlusMinus);
-        rMinus = nMinus / (nMinusMinus + nPlusMinus);
-
-        p = segmentWidth * (rPlus - rMinus) / (rPlus + rMinus + 1);
-
-        pError
-            = segmentWidth
-              * pow(1 / ((nMinus * (nPlusMinus + nPlusPlus) + (nMinusMinus + nPlusMinus) * (nPlus + nPlusMinus + nPlusPlus))), 2)
-              * sqrt(pow((nMinusMinus + nPlusMinus) * (nPlusMinus + nPlusPlus), 2)
-                         * (pow(nPlusError * (2 * nMinus + nMinusMinus + nPlusMinus), 2)
-                            + pow(nMinusError * (2 * nPlus + nPlusPlus + nPlusMinus), 2))
-                     + pow((nPlus * (nPlusMinus + nMinusMinus) * (2 * nMinus + nMinusMinus + nPlusMinus) * nPlusPlusError), 2)
-                     + pow((nPlusMinusError
-                            * (nPlus * pow((nMinusMinus + nPlusMinus), 2)
-                               + nMinus * (2 * nMinusMinus * nPlus - 2 * nPlus * nPlusPlus - pow((nPlusMinus + nPlusPlus), 2)))),
-                           2)
-                     + pow((nMinus * (nPlusMinus + nPlusPlus) * (2 * nPlus + nPlusMinus + nPlusPlus) * nMinusMinusError), 2));
+        thread.join();
+    }
+
+    std::chrono::duration<double> wallTime = std::chrono::steady_clock::now() - start;
+
+    // Idle time is whatever each worker spent waiting for the slowest one to finish
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Worker load over " << wallTime.count() << " s (" << queue.Steals() << " runs stolen).\n"
+         << resetFormats;
+    cout << "--------------------------------------------\n";
+
+    for (int worker = 0; worker < workerCount; worker++)
+    {
+        cout << boldOn << "Worker " << worker << ": " << resetFormats << runsRead[worker] << " runs, busy "
+             << busyTime[worker] << " s, idle " << wallTime.count() - busyTime[worker] << " s\n";
+    }
+    cout << "--------------------------------------------\n";
+
+    // Merging once in worker order
+    ProfileScope merge("Merge workers");
+
+    for (auto const& worker : workers)
+    {
+        MergeHistograms(*worker);
+    }
+
+    merge.Close();
+
+    lineCounter = runCount;
+    index = runCount;
+
+    PrintReadTotals();
+}
+
+void BiPo::PrintReadTotals()
+{
+    if (!IO_VERBOSITY || eventCache)
+        return;
+
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Read " << bytesRead / 1048576.0 << " MB in " << readCalls << " calls.\n" << resetFormats;
+
+    // Whole entries would have decompressed every branch of every entry
+    if (unzippedFullBytes > 0)
+    {
+        cout << boldOn << "Decompressed: " << resetFormats << unzippedBytes / 1048576.0 << " MB of "
+             << unzippedFullBytes / 1048576.0 << " MB in whole entries ("
+             << 100.0 * (1 - double(unzippedBytes) / unzippedFullBytes) << " % less).\n";
+    }
+
+    cout << "--------------------------------------------\n";
+}
+
+void BiPo::ProcessRun(std::size_t run)
+{
+    if (eventCache)
+    {
+        FillFromCache(run);
+        return;
+    }
+
+    OpenedRun opened = OpenRun(run, false);
+    ProcessOpenedRun(opened);
+}
+
+OpenedRun BiPo::OpenRun(std::size_t run, bool prefetch) const
+{
+    ProfileScope scope("Open file");
+
+    OpenedRun opened;
+    opened.run = run;
+
+    // Combining names into root file name
+    TString rootFilename = RunPath(files[run]);
+
+    // Open the root file
+    opened.file = std::make_unique<TFile>(rootFilename);
+
+    // Grab rootTree and cast to unique pointer
+    opened.tree = std::shared_ptr<TTree>(static_cast<TTree*>(opened.file->Get(TreeName())));
+
+    if (!prefetch || !opened.tree)
+        return opened;
+
+    // Pulling the baskets of the branches we use into memory now, so the fill thread doesn't wait on the disk
+    vector<char const*> names(branchNames.begin(), branchNames.end());
+
+    if (!SINGLES_FILE_NAME.empty())
+        names.assign(singlesBranchNames.begin(), singlesBranchNames.end());
+
+    opened.tree->SetBranchStatus("*", 0);
+
+    for (char const* name : names)
+    {
+        opened.tree->SetBranchStatus(name, 1);
+
+        if (TBranch* branch = opened.tree->GetBranch(name))
+            branch->LoadBaskets();
+    }
+
+    return opened;
+}
+
+void BiPo::ProcessOpenedRun(OpenedRun& opened)
+{
+    if (!SINGLES_FILE_NAME.empty())
+    {
+        ProcessSinglesRun(opened);
+        return;
+    }
+
+    ProfileScope scope("Run");
+
+    string const& run = files[opened.run];
+    std::shared_ptr<TTree> rootTree = opened.tree;
+    TFile* rootFile = opened.file.get();
+
+    if (!rootTree)
+    {
+        cout << "No BiPo tree in: " << RunPath(run) << '\n';
+        return;
+    }
+
+    SetBranchAddresses(rootTree);
+    SelectDetectorPeriod(run);
+
+    if (skimCache)
+        skimCache->BeginRun(run);
+
+    vector<CountSet> totals = SplitRunCounts();
+
+    long nEntries = rootTree->GetEntries();
+    long runUnzipped = 0, runUnzippedFull = 0;
+
+    for (TBranch* branch : alphaBranches)
+    {
+        runUnzippedFull += branch->GetTotBytes();
+    }
+
+    for (TBranch* branch : betaBranches)
+    {
+        runUnzippedFull += branch->GetTotBytes();
+    }
+
+    // One scope for the whole loop, a scope per entry would cost more than the cuts and fills it times. The phases
+    // within it are timed on a sample of the entries
+    enum
+    {
+        ReadAlpha,
+        AlphaCuts,
+        ReadBetas,
+        Skim,
+        BetaCutsAndFills
+    };
+
+    ProfileScope loop("Entry loop");
+    PhaseTimer phases({"Read alpha", "Alpha cuts", "Read betas", "Skim", "Beta cuts and fills"});
+
+    for (long i = 0; i < nEntries; i++)
+    {
+        phases.Begin(i);
+        long entry = rootTree->LoadTree(i);
+
+        for (TBranch* branch : alphaBranches)
+        {
+            runUnzipped += branch->GetEntry(entry);
+        }
+
+        phases.Switch(AlphaCuts);
+
+        // Doing our own fiducial cut
+        if (FiducialCut(alphaSegment))
+        {
+            counts[0].cutFlow.alpha[AlphaFiducial]++;
+            continue;
+        }
+
+        // Applying alpha cuts
+        if (abs(alphaZ) > 1000)
+        {
+            counts[0].cutFlow.alpha[AlphaZ]++;
+            continue;
+        }
+
+        // The skim keeps alphas failing the energy and PSD cuts, so it needs their betas too
+        bool pass = PassAlphaCuts();
+
+        if (!pass && !skimCache)
+            continue;
+
+        phases.Switch(ReadBetas);
+
+        for (TBranch* branch : betaBranches)
+        {
+            runUnzipped += branch->GetEntry(entry);
+        }
+
+        phases.Switch(Skim);
+
+        if (skimCache)
+            SkimEntry();
+
+        if (!pass)
+            continue;
+
+        phases.Switch(BetaCutsAndFills);
+        FillHistogram();
+    }
+
+    phases.Close();
+    loop.Close();
+
+    MergeRunCounts(opened.run, totals);
+
+    unzippedBytes += runUnzipped;
+    unzippedFullBytes += runUnzippedFull;
+
+    std::ostringstream detail;
+    detail << "decompressed " << runUnzipped / 1048576.0 << " of " << runUnzippedFull / 1048576.0 << " MB";
+    CountFileReads(rootFile, run, detail.str());
+    Profiler::Get().RecordSlowest(run, scope.Close());
+
+    // rootFile->Close();
+}
+
+void BiPo::ProcessSinglesRun(OpenedRun& opened)
+{
+    ProfileScope scope("Singles run");
+
+    string const& run = files[opened.run];
+    std::shared_ptr<TTree> rootTree = opened.tree;
+    TFile* rootFile = opened.file.get();
+
+    if (!rootTree)
+    {
+        cout << "No Singles tree in: " << RunPath(run) << '\n';
+        return;
+    }
+
+    SelectDetectorPeriod(run);
+
+    if (skimCache)
+        skimCache->BeginRun(run);
+
+    vector<CountSet> totals = SplitRunCounts();
+
+    rootTree->SetBranchStatus("*", 0);
+
+    for (char const* branch : singlesBranchNames)
+    {
+        rootTree->SetBranchStatus(branch, 1);
+    }
+
+    if (TREE_CACHE_MB > 0)
+    {
+        rootTree->SetCacheSize(TREE_CACHE_MB * 1024L * 1024L);
+
+        for (char const* branch : singlesBranchNames)
+        {
+            rootTree->AddBranchToCache(branch, kTRUE);
+        }
+
+        rootTree->StopCacheLearningPhase();
+    }
+
+    Double_t time, z, energy, psd;
+    Int_t segment, cluster, clusterIonization;
+
+    rootTree->SetBranchAddress("t", &time);  // cluster timing in us
+    rootTree->SetBranchAddress("seg", &segment);  // cluster segment number
+    rootTree->SetBranchAddress("z", &z);  // cluster Z position in mm
+    rootTree->SetBranchAddress("E", &energy);  // cluster energy in MeV
+    rootTree->SetBranchAddress("PSD", &psd);  // cluster PSD
+    rootTree->SetBranchAddress("mult_clust", &cluster);
+    rootTree->SetBranchAddress("mult_clust_ioni", &clusterIonization);
+
+    // FillHistogram reads the built windows through the same pointers as the plugin's branches
+    pseg = &builtPrompt.segment;
+    pt = &builtPrompt.time;
+    pz = &builtPrompt.z;
+    pPSD = &builtPrompt.psd;
+    pEtot = &builtPrompt.energy;
+    pmult_clust = &builtPrompt.cluster;
+    pmult_clust_ioni = &builtPrompt.clusterIonization;
+    fseg = &builtFar.segment;
+    ft = &builtFar.time;
+    fz = &builtFar.z;
+    fPSD = &builtFar.psd;
+    fEtot = &builtFar.energy;
+    fmult_clust = &builtFar.cluster;
+    fmult_clust_ioni = &builtFar.clusterIonization;
+
+    CoincidenceBuilder builder(SinglesWindows());
+
+    auto fill = [this](Coincidence const& coincidence)
+    {
+        LoadCoincidence(coincidence);
+        FillCoincidence();
+    };
+
+    long nEntries = rootTree->GetEntries();
+    long outOfOrder = 0;
+    double lastTime = -std::numeric_limits<double>::infinity();
+
+    enum
+    {
+        ReadCluster,
+        BuildAndFill
+    };
+
+    ProfileScope loop("Entry loop");
+    PhaseTimer phases({"Read cluster", "Build and fill"});
+
+    for (long i = 0; i < nEntries; i++)
+    {
+        phases.Begin(i);
+        rootTree->GetEntry(i);
+        phases.Switch(BuildAndFill);
+
+        // The builder relies on the time order, a cluster going back in time can't be placed in the windows
+        if (time < lastTime)
+        {
+            outOfOrder++;
+            continue;
+        }
+
+        lastTime = time;
+        SingleCluster single{time, segment, (float)z, (float)energy, (float)psd, cluster, clusterIonization};
+        builder.Add(single, fill);
+    }
+
+    builder.Finish(fill);
+    phases.Close();
+    loop.Close();
+
+    MergeRunCounts(opened.run, totals);
+
+    // One write per file so lines from different threads don't mix
+    if (outOfOrder > 0)
+    {
+        std::ostringstream line;
+        line << redOn << outOfOrder << " clusters out of time order skipped in: " << run << resetFormats << '\n';
+        cout << line.str();
+    }
+
+    CountFileReads(rootFile, run, std::to_string(nEntries) + " clusters");
+    Profiler::Get().RecordSlowest(run, scope.Close());
+}
+
+vector<BiPo::CountSet> BiPo::SplitRunCounts()
+{
+    // Filling the run on its own so its counts can be kept for later jobs or for resampling. counts starts empty and
+    // the totals so far wait in the returned vector, which stays empty when runs aren't kept
+    vector<CountSet> totals;
+
+    if (runCache || SeparateRunCounts())
+    {
+        totals.assign(counts.size(), CountSet());
+        counts.swap(totals);
+    }
+
+    return totals;
+}
+
+void BiPo::MergeRunCounts(std::size_t run, vector<CountSet>& totals)
+{
+    if (totals.empty())
+        return;
+
+    // After the swap totals holds the counts of this run alone
+    counts.swap(totals);
+    vector<CountSet> const& runCounts = totals;
+
+    if (runCache)
+        runCache->Save(RunPath(files[run]), runCounts);
+
+    KeepRunCounts(run, runCounts);
+    AddCounts(counts, runCounts);
+}
+
+void BiPo::CountFileReads(TFile* file, string const& run, string const& detail)
+{
+    bytesRead += file->GetBytesRead();
+    readCalls += file->GetReadCalls();
+
+    if (IO_VERBOSITY)
+    {
+        // One write per file so lines from different threads don't mix
+        std::ostringstream line;
+        line << "Read " << file->GetBytesRead() / 1048576.0 << " MB in " << file->GetReadCalls() << " calls, " << detail
+             << " from: " << run << '\n';
+        cout << line.str();
+    }
+}
+
+CoincidenceWindows BiPo::SinglesWindows() const
+{
+    // Wide enough for every configuration, FillBeta and PassAlphaCuts apply each one's own windows and cuts
+    float infinity = std::numeric_limits<float>::infinity();
+    CoincidenceWindows windows{0, infinity, 0, infinity, -infinity, infinity, -infinity};
+
+    for (CutConfig const& cuts : cutConfigs)
+    {
+        windows.promptLength = std::max<double>(windows.promptLength, cuts.timeEnd);
+        windows.farStart = std::min<double>(windows.farStart, cuts.accTimeStart);
+        windows.farEnd = std::max<double>(windows.farEnd, cuts.accTimeEnd);
+        windows.lowAlphaEnergy = std::min(windows.lowAlphaEnergy, cuts.lowAlphaEnergy);
+        windows.highAlphaEnergy = std::max(windows.highAlphaEnergy, cuts.highAlphaEnergy);
+        windows.lowAlphaPSD = std::min(windows.lowAlphaPSD, cuts.lowAlphaPSD);
+        windows.highAlphaPSD = std::max(windows.highAlphaPSD, cuts.highAlphaPSD);
+    }
+
+    return windows;
+}
+
+void BiPo::MergeHistograms(BiPo& worker)
+{
+    AddCounts(counts, worker.counts);
+
+    // Run counts are moved, there can be one per run of the whole list
+    partialRuns.insert(partialRuns.end(), worker.partialRuns.begin(), worker.partialRuns.end());
+    runPartials.insert(runPartials.end(), std::make_move_iterator(worker.runPartials.begin()),
+                       std::make_move_iterator(worker.runPartials.end()));
+    worker.partialRuns.clear();
+    worker.runPartials = vector<RunSignals>();
+
+    for (auto const& [number, slice] : worker.slices)
+    {
+        AddSignals(slices[number].signals, slice.signals, 1);
+        slices[number].runs += slice.runs;
+    }
+
+    unslicedRuns += worker.unslicedRuns;
+    worker.slices.clear();
+
+    for (std::size_t cell = 0; cell < binnedCounts.size(); cell++)
+    {
+        AddSignals(binnedCounts[cell], worker.binnedCounts[cell], 1);
+    }
+
+    bytesRead += worker.bytesRead;
+    readCalls += worker.readCalls;
+    unzippedBytes += worker.unzippedBytes;
+    unzippedFullBytes += worker.unzippedFullBytes;
+
+    if (skimCache)
+        skimCache->Append(*worker.skimCache);
+}
+
+void BiPo::AddCounts(vector<CountSet>& total, vector<CountSet> const& partial)
+{
+    // The histograms only hold integer counts and fixed point sums, so the merged contents, errors and statistics don't
+    // depend on how the runs were split between workers, jobs or shards
+    for (std::size_t config = 0; config < total.size(); config++)
+    {
+        AddSignals(total[config].signals, partial[config].signals, 1);
+        total[config].cutFlow.Add(partial[config].cutFlow);
+    }
+}
+
+void BiPo::AddSignals(RunSignals& total, RunSignals const& partial, int times)
+{
+    for (int dataset = Data; dataset < DatasetSize; dataset++)
+    {
+        for (int signalSet = Correlated; signalSet < TotalDifference; signalSet++)
+        {
+            SignalCounts& sum = total[dataset][signalSet];
+            SignalCounts const& add = partial[dataset][signalSet];
+
+            sum.x.Add(add.x, times);
+            sum.y.Add(add.y, times);
+            sum.z.Add(add.z, times);
+            sum.multiplicity.Add(add.multiplicity, times);
+        }
+    }
+}
+
+void BiPo::KeepRunCounts(std::size_t run, vector<CountSet> const& runCounts)
+{
+    // Only the nominal cuts are resampled and sliced
+    if (Resampling())
+    {
+        partialRuns.push_back(run);
+        runPartials.push_back(runCounts[0].signals);
+    }
+
+    if (SLICE_SECONDS == 0)
+        return;
+
+    long long timestamp = RunTimestamp(eventCache ? eventCache->runs[run] : files[run]);
+
+    if (timestamp == 0)
+    {
+        unslicedRuns++;
+        return;
+    }
+
+    Slice& slice = slices[(timestamp - sliceOrigin) / SLICE_SECONDS];
+    AddSignals(slice.signals, runCounts[0].signals, 1);
+    slice.runs++;
+}
+
+vector<std::size_t> BiPo::LoadPartials()
+{
+    ProfileScope scope("Load run cache");
+
+    // Runs belonging to this shard, strided so every shard gets a mix of long and short runs
+    vector<std::size_t> shardRuns, pending;
+
+    for (std::size_t run = 0; run < RunCount(); run++)
+    {
+        if (SHARD_COUNT == 0 || (int)(run % SHARD_COUNT) == SHARD_INDEX)
+            shardRuns.push_back(run);
+    }
+
+    if (RUN_CACHE_DIR.empty() || eventCache || skimCache || !binnedCounts.empty())
+    {
+        if (!RUN_CACHE_DIR.empty())
+            cout << "Run cache is only used when reading ROOT files without skimming or binning.\n";
+
+        return shardRuns;
+    }
+
+    runCache = std::make_shared<RunCache const>(RUN_CACHE_DIR, CutHash());
+
+    vector<CountSet> partial(counts.size());
+    std::size_t loaded = 0;
+
+    for (std::size_t run : shardRuns)
+    {
+        if (runCache->Load(RunPath(files[run]), partial))
+        {
+            KeepRunCounts(run, partial);
+            AddCounts(counts, partial);
+            loaded++;
+        }
+        else
+        {
+            pending.push_back(run);
+        }
+    }
+
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Run cache: " << resetFormats << loaded << " runs loaded from " << RUN_CACHE_DIR << ", "
+         << pending.size() << " to read.\n";
+    cout << "--------------------------------------------\n";
+
+    return pending;
+}
+
+void BiPo::WriteShard()
+{
+    std::ostringstream label, name;
+    label << "shard " << SHARD_INDEX << "/" << SHARD_COUNT;
+    name << "BiPoShard_" << SHARD_INDEX << "_of_" << SHARD_COUNT << ".part";
+
+    RunKey key;
+    key.cutHash = CutHash();
+
+    if (!WritePartial(name.str(), label.str(), key, counts))
+    {
+        cout << "Couldn't write shard output: " << name.str() << '\n';
+        return;
+    }
+
+    cout << boldOn << cyanOn << "Wrote " << label.str() << ": " << resetFormats << blueOn << boldOn << name.str() << "!\n"
+         << resetFormats;
+    cout << "--------------------------------------------\n";
+}
+
+bool BiPo::MergeShards()
+{
+    ProfileScope scope("Merge shards");
+
+    // Finding the shard count from the file names, every shard from 0 to N - 1 has to be there. Outputs of jobs split
+    // another way would be merged silently or break the merge, so they have to be moved out first
+    std::set<int> shardCounts;
+    std::error_code error;
+
+    for (auto const& entry : std::filesystem::directory_iterator(MERGE_DIR, error))
+    {
+        int shard, count;
+
+        if (std::sscanf(entry.path().filename().c_str(), "BiPoShard_%d_of_%d.part", &shard, &count) == 2 && count > 0)
+            shardCounts.insert(count);
+    }
+
+    if (shardCounts.empty())
+    {
+        cout << "No shard outputs found in: " << MERGE_DIR << '\n';
+        return false;
+    }
+
+    if (shardCounts.size() > 1)
+    {
+        cout << "Shard outputs of jobs split into";
+
+        for (int count : shardCounts)
+        {
+            cout << ' ' << count;
+        }
+
+        cout << " parts found in: " << MERGE_DIR << ", keep only one of them.\n";
+        return false;
+    }
+
+    int shardCount = *shardCounts.begin();
+
+    RunKey key;
+    key.cutHash = CutHash();
+
+    vector<vector<CountSet>> shards(shardCount, vector<CountSet>(counts.size()));
+    vector<char> loaded(shardCount, 0);
+    int threadCount = std::min<int>(std::max<int>(WORKER_COUNT, std::thread::hardware_concurrency()), shardCount);
+
+    // Loading the shards in parallel
+    ForEachParallel(shardCount, threadCount,
+                    [&](std::size_t shard)
+                    {
+                        std::ostringstream label, name;
+                        label << "shard " << shard << "/" << shardCount;
+                        name << MERGE_DIR << "/BiPoShard_" << shard << "_of_" << shardCount << ".part";
+
+                        loaded[shard] = ReadPartial(name.str(), label.str(), key, shards[shard]);
+                    });
+
+    for (int shard = 0; shard < shardCount; shard++)
+    {
+        if (!loaded[shard])
+        {
+            cout << "Missing shard " << shard << "/" << shardCount << " in " << MERGE_DIR
+                 << ", or it was written with different cuts.\n";
+            return false;
+        }
+    }
+
+    // Reducing as a tree, the pairs of each level are spread over the same threads as the loading
+    for (int stride = 1; stride < shardCount; stride *= 2)
+    {
+        int pairs = (shardCount - stride + 2 * stride - 1) / (2 * stride);
+
+        ForEachParallel(pairs, std::min(threadCount, pairs),
+                        [&shards, stride](std::size_t pair)
+                        {
+                            std::size_t shard = 2 * stride * pair;
+                            AddCounts(shards[shard], shards[shard + stride]);
+                        });
+    }
+
+    AddCounts(counts, shards[0]);
+
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Merged " << shardCount << " shards from: " << resetFormats << MERGE_DIR << '\n';
+    cout << "--------------------------------------------\n";
+
+    return true;
+}
+
+std::uint64_t BiPo::CutHash() const
+{
+    // Everything the fill depends on besides the run itself
+    std::uint64_t hash = HashBytes(&settings.n2f, sizeof(settings.n2f));
+
+    for (CutConfig const& cuts : cutConfigs)
+    {
+        for (auto const& parameter : ScanParameters())
+        {
+            hash = HashBytes(&(cuts.*parameter.second), sizeof(float), hash);
+        }
+
+        hash = HashBytes(&cuts.accTimeStart, sizeof(float), hash);
+        hash = HashBytes(&cuts.accTimeEnd, sizeof(float), hash);
+    }
+
+    // Editing the detector periods changes which neighbours count as live
+    for (DetectorPeriod const& period : detectorPeriods)
+    {
+        hash = HashBytes(&period.start, sizeof(period.start), hash);
+
+        for (int segment = 0; segment < SegmentTable::segments; segment++)
+        {
+            hash = HashBytes(&period.segments[segment], sizeof(SegmentInfo), hash);
+        }
+    }
+
+    return hash;
+}
+
+void BiPo::SelectDetectorPeriod(string const& run)
+{
+    // Once per run, so the per-candidate lookups stay a single load
+    std::size_t period = DetectorPeriodAt(detectorPeriods, RunTimestamp(run));
+    SegmentTable const* periodSegments = &detectorPeriods[period].segments;
+
+    // The batched beta selection keeps its own copy of the fiducial cut
+    if (periodSegments != segments)
+    {
+        segments = periodSegments;
+        SetRejectSegments();
+    }
+}
+
+void BiPo::SkimEntry()
+{
+    // Only the fixed geometry and cluster cuts are applied so any energy, PSD or time cut can be rerun on the skim
+    skimCache->AddAlpha(alphaSegment, alphaEnergy, alphaPSD, alphaZ);
+
+    for (int j = 0; j < multCorrelated; j++)
+    {
+        if (FiducialCut(pseg->at(j)) || std::abs(pz->at(j)) > 1000 || pmult_clust->at(j) != pmult_clust_ioni->at(j))
+            continue;
+
+        skimCache->prompt.Add(j, pseg->at(j), pEtot->at(j), pPSD->at(j), pz->at(j), alphaTime - pt->at(j));
+    }
+
+    for (int j = 0; j < multAccidental; j++)
+    {
+        if (FiducialCut(fseg->at(j)) || std::abs(fz->at(j)) > 1000 || fmult_clust->at(j) != fmult_clust_ioni->at(j))
+            continue;
+
+        skimCache->far.Add(j, fseg->at(j), fEtot->at(j), fPSD->at(j), fz->at(j), ft->at(j) - alphaTime);
+    }
+}
+
+void BiPo::FillFromCache(std::size_t run)
+{
+    ProfileScope scope("Cache run");
+
+    MappedEventCache const& cache = *eventCache;
+    std::uint64_t firstAlpha = cache.runOffset[run], lastAlpha = cache.runOffset[run + 1];
+
+    SelectDetectorPeriod(cache.runs[run]);
+
+    vector<CountSet> totals = SplitRunCounts();
+
+    for (int signalSet = Correlated; signalSet < TotalDifference; signalSet++)
+    {
+        BetaColumnView const& betas = (signalSet == Correlated) ? cache.prompt : cache.far;
+        std::uint64_t firstBeta = betas.offset[firstAlpha];
+        std::size_t betaCount = betas.offset[lastAlpha] - firstBeta;
+
+        batchAlphaSegment.resize(betaCount);
+        batchAlphaZ.resize(betaCount);
+        selectedBetas.resize(betaCount);
+
+        // Every configuration is selected from the same mapped columns
+        for (std::size_t config = 0; config < cutConfigs.size(); config++)
+        {
+            CutConfig const& cuts = cutConfigs[config];
+
+            // Spreading each alpha over its betas. Fiducial and z cuts were applied by the skim, betas of alphas
+            // failing the energy or PSD cut are marked with segment -1
+            for (std::uint64_t alpha = firstAlpha; alpha < lastAlpha; alpha++)
+            {
+                int failed = AlphaCutFailed(cuts, cache.alphaEnergy[alpha], cache.alphaPSD[alpha]);
+                bool pass = (failed == AlphaPassed);
+
+                // Alphas are counted once, with the prompt window
+                if (config == 0 && signalSet == Correlated)
+                    counts[0].cutFlow.alpha[failed]++;
+
+                for (std::uint64_t beta = betas.offset[alpha]; beta < betas.offset[alpha + 1]; beta++)
+                {
+                    batchAlphaSegment[beta - firstBeta] = pass ? cache.alphaSegment[alpha] : -1;
+                    batchAlphaZ[beta - firstBeta] = cache.alphaZ[alpha];
+                }
+            }
+
+            BetaBatch batch{betaCount,
+                            &betas.segment[firstBeta],
+                            &betas.energy[firstBeta],
+                            &betas.psd[firstBeta],
+                            &betas.z[firstBeta],
+                            &betas.deltaTime[firstBeta],
+                            batchAlphaSegment.data(),
+                            batchAlphaZ.data()};
+
+            // The nominal cuts also count what each cut rejected, the other configurations only select
+            std::array<std::size_t, BetaSelection::stages> rejected{};
+
+            ProfileScope select("Select");
+            std::size_t selectedCount = BetaSelection::Select(batch, windowCuts[config][signalSet],
+                                                              selectedBetas.data(), config == 0 ? rejected.data() : nullptr);
+            select.Close();
+
+            if (config == 0)
+            {
+                auto& flow = counts[0].cutFlow.beta[signalSet];
+
+                flow[BetaFiducial] += rejected[BetaSelection::Segment];
+                flow[BetaZ] += rejected[BetaSelection::Z];
+                flow[BetaDz] += rejected[BetaSelection::Dz];
+                flow[BetaEnergy] += rejected[BetaSelection::Energy];
+                flow[BetaPSD] += rejected[BetaSelection::PSD];
+                flow[BetaDisplacement] += rejected[BetaSelection::Displacement];
+                flow[BetaTime] += rejected[BetaSelection::Time];
+                flow[BetaPassed] += selectedCount;
+            }
+
+            // One scope per batch, not per selected beta
+            ProfileScope fill("Fill");
+
+            for (std::size_t i = 0; i < selectedCount; i++)
+            {
+                std::uint32_t selected = selectedBetas[i];
+                std::uint64_t beta = firstBeta + selected;
+
+                alphaSegment = batchAlphaSegment[selected];
+                alphaZ = batchAlphaZ[selected];
+
+                CalculateDisplacement(betas.segment[beta], betas.z[beta]);
+                FillSelected(signalSet, betas.index[beta], betas.segment[beta], config, betas.energy[beta]);
+            }
+        }
+    }
+
+    MergeRunCounts(run, totals);
+
+    cache.Release(run);
+    Profiler::Get().RecordSlowest(cache.runs[run], scope.Close());
+}
+
+void BiPo::ReadEventCache()
+{
+    ProfileScope scope("Read event cache");
+
+    auto cache = std::make_shared<MappedEventCache>();
+
+    if (!cache->Open(CACHE_FILE))
+    {
+        cout << "Event cache not found or unreadable! Exiting.\n";
+        cout << "Trying to find: " << CACHE_FILE << '\n';
+        return;
+    }
+
+    eventCache = cache;
+    lineNumber = cache->Runs();
+
+    cout << boldOn << cyanOn << "Read event cache: " << resetFormats << cache->Runs() << " runs, " << cache->Alphas()
+         << " alphas, " << cache->prompt.Size() << " prompt and " << cache->far.Size() << " far betas.\n";
+}
+
+void BiPo::WriteEventCache()
+{
+    ProfileScope scope("Write event cache");
+
+    if (!skimCache->Write(SKIM_FILE))
+    {
+        cout << "Could not write event cache: " << SKIM_FILE << '\n';
+        return;
+    }
+
+    cout << boldOn << cyanOn << "Wrote event cache: " << resetFormats << blueOn << boldOn << SKIM_FILE << resetFormats
+         << " (" << skimCache->Runs() << " runs, " << skimCache->Alphas() << " alphas).\n";
+}
+
+void BiPo::SetBranchAddresses(std::shared_ptr<TTree> rootTree)
+{
+    // Set object pointer
+    pseg = 0;
+    pt = 0;
+    pz = 0;
+    pPSD = 0;
+    pEtot = 0;
+    pmult_clust = 0;
+    pmult_clust_ioni = 0;
+    fseg = 0;
+    ft = 0;
+    fz = 0;
+    fPSD = 0;
+    fEtot = 0;
+    fmult_clust = 0;
+    fmult_clust_ioni = 0;
+
+    // Branches of the previous file went with it
+    alphaBranches.fill(nullptr);
+    betaBranches.fill(nullptr);
+
+    // Set branch addresses and branch pointers
+    if (!rootTree)
+        return;
+
+    // Only decompressing the branches FillHistogram uses
+    rootTree->SetBranchStatus("*", 0);
+
+    for (char const* branch : branchNames)
+    {
+        rootTree->SetBranchStatus(branch, 1);
+    }
+
+    // Read cache holds exactly those branches, so there's no learning phase reading everything
+    if (TREE_CACHE_MB > 0)
+    {
+        rootTree->SetCacheSize(TREE_CACHE_MB * 1024L * 1024L);
+
+        for (char const* branch : branchNames)
+        {
+            rootTree->AddBranchToCache(branch, kTRUE);
+        }
+
+        rootTree->StopCacheLearningPhase();
+    }
+
+    // Prompt Window
+    rootTree->SetBranchAddress("pseg", &pseg, &b_pseg);  // beta segment number
+    rootTree->SetBranchAddress("pt", &pt, &b_pt);  // beta timing in us
+    rootTree->SetBranchAddress("pz", &pz, &b_pz);  // beta position in Z position, given in mm
+    rootTree->SetBranchAddress("pPSD", &pPSD, &b_pPSD);  // beta PSD
+    rootTree->SetBranchAddress("pEtot", &pEtot, &b_pEtot);  // beta total energy in MeV
+    rootTree->SetBranchAddress("pmult_clust", &pmult_clust, &b_pmult_clust);  // prompt cluster
+                                                                              // multiplicity
+    rootTree->SetBranchAddress("pmult_clust_ioni", &pmult_clust_ioni, &b_pmult_clust_ioni);  // prompt cluster multiplicity
+                                                                                             // ionization?
+    // Far Window
+    rootTree->SetBranchAddress("fseg", &fseg, &b_fseg);  // beta segment number
+    rootTree->SetBranchAddress("ft", &ft, &b_ft);  // beta timing in us
+    rootTree->SetBranchAddress("fz", &fz, &b_fz);  // beta position in Z position, given in mm
+    rootTree->SetBranchAddress("fPSD", &fPSD, &b_fPSD);  // beta PSD
+    rootTree->SetBranchAddress("fEtot", &fEtot, &b_fEtot);  // beta total energy in MeV
+    rootTree->SetBranchAddress("fmult_clust", &fmult_clust, &b_fmult_clust);  // prompt cluster
+                                                                              // multiplicity
+    rootTree->SetBranchAddress("fmult_clust_ioni", &fmult_clust_ioni, &b_fmult_clust_ioni);  // prompt cluster multiplicity
+                                                                                             // ionization?
+    // Alpha
+    rootTree->SetBranchAddress("aseg", &alphaSegment, &b_aseg);  // alpha segment number
+    rootTree->SetBranchAddress("aE", &alphaEnergy, &b_aE);  // alpha energy in MeV
+    rootTree->SetBranchAddress("at", &alphaTime, &b_at);  // alpha timing in us
+    rootTree->SetBranchAddress("az", &alphaZ, &b_az);
+    rootTree->SetBranchAddress("aPSD", &alphaPSD, &b_aPSD);  // alpha PSD
+    rootTree->SetBranchAddress("mult_prompt", &multCorrelated, &b_mult_prompt);  // prompt
+                                                                                 // multiplicity for
+                                                                                 // correlated
+    rootTree->SetBranchAddress("mult_far", &multAccidental, &b_mult_far);  // prompt multiplicity
+                                                                           // for accidentals
+
+    alphaBranches = {b_aseg, b_aE, b_at, b_az, b_aPSD, b_mult_prompt, b_mult_far};
+    betaBranches = {b_pseg, b_pt, b_pz, b_pPSD, b_pEtot, b_pmult_clust, b_pmult_clust_ioni,
+                    b_fseg, b_ft, b_fz, b_fPSD, b_fEtot, b_fmult_clust, b_fmult_clust_ioni};
+}
+
+void BiPo::FillHistogram()
+{
+    for (int j = 0; j < multCorrelated; j++)
+    {
+        // Grabbing beta values
+        BetaCandidate beta{pseg->at(j),
+                           (float)pEtot->at(j),
+                           (float)pPSD->at(j),
+                           (float)pz->at(j),
+                           alphaTime - pt->at(j),
+                           pmult_clust->at(j) == pmult_clust_ioni->at(j)};
+
+        FillBeta(Correlated, j, beta);
+    }
+
+    for (int j = 0; j < multAccidental; j++)
+    {
+        // Grabbing beta values
+        BetaCandidate beta{fseg->at(j),
+                           (float)fEtot->at(j),
+                           (float)fPSD->at(j),
+                           (float)fz->at(j),
+                           ft->at(j) - alphaTime,
+                           fmult_clust->at(j) == fmult_clust_ioni->at(j)};
+
+        FillBeta(Accidental, j, beta);
+    }
+}
+
+void BiPo::LoadCoincidence(Coincidence const& coincidence)
+{
+    alphaSegment = coincidence.alpha.segment;
+    alphaEnergy = coincidence.alpha.energy;
+    alphaTime = coincidence.alpha.time;
+    alphaZ = coincidence.alpha.z;
+    alphaPSD = coincidence.alpha.psd;
+    multCorrelated = coincidence.prompt.size();
+    multAccidental = coincidence.far.size();
+
+    builtPrompt.Load(coincidence.prompt);
+    builtFar.Load(coincidence.far);
+}
+
+void BiPo::FillCoincidence()
+{
+    // Same alpha cuts as an entry of the plugin's tree
+    if (FiducialCut(alphaSegment))
+    {
+        counts[0].cutFlow.alpha[AlphaFiducial]++;
+        return;
+    }
+
+    if (abs(alphaZ) > 1000)
+    {
+        counts[0].cutFlow.alpha[AlphaZ]++;
+        return;
+    }
+
+    bool pass = PassAlphaCuts();
+
+    if (skimCache)
+        SkimEntry();
+
+    if (pass)
+        FillHistogram();
+}
+
+void BiPo::FillBeta(int signalSet, int j, BetaCandidate const& beta)
+{
+    int betaSegment = beta.segment;
+
+    // Cut flow of the nominal cuts, betas of alphas failing them are counted in scratch space instead
+    long long* flow = alphaPass[0] ? counts[0].cutFlow.beta[signalSet].data() : uncountedBetas.data();
+
+    // Fiducial cut for beta
+    if (FiducialCut(betaSegment))
+    {
+        flow[BetaFiducial]++;
+        return;
+    }
+
+    // Applying beta cuts that every configuration shares
+    if (std::abs(beta.z) > 1000)
+    {
+        flow[BetaZ]++;
+        return;
+    }
+
+    if (!beta.clusterMatch)
+    {
+        flow[BetaCluster]++;
+        return;
+    }
+
+    CalculateDisplacement(betaSegment, beta.z);
+
+    displacement = std::sqrt(dx * dx + dy * dy + dz * dz);
+
+    if (signalSet == Accidental && std::abs(dz) > 250)
+    {
+        flow[BetaDz]++;
+        return;
+    }
+
+    for (std::size_t config = 0; config < cutConfigs.size(); config++)
+    {
+        if (!alphaPass[config])
+            continue;
+
+        CutConfig const& cuts = cutConfigs[config];
+        int failed = BetaPassed;
+
+        // Correlated betas come before the alpha, accidentals are taken from the far window after it
+        double windowStart = (signalSet == Correlated) ? cuts.timeStart : cuts.accTimeStart;
+        double windowEnd = (signalSet == Correlated) ? cuts.timeEnd : cuts.accTimeEnd;
+
+        if (beta.energy < cuts.lowBetaEnergy || beta.energy > cuts.highBetaEnergy)
+            failed = BetaEnergy;
+        else if (beta.psd < cuts.lowBetaPSD || beta.psd > cuts.highBetaPSD)
+            failed = BetaPSD;
+        else if (displacement > cuts.maxDisplacement)
+            failed = BetaDisplacement;
+        else if (!(beta.deltaTime > windowStart && beta.deltaTime < windowEnd))
+            failed = BetaTime;
+
+        if (config == 0)
+            flow[failed]++;
+
+        if (failed == BetaPassed)
+            FillSelected(signalSet, j, betaSegment, config, beta.energy);
+    }
+}
+
+bool BiPo::PassAlphaCuts()
+{
+    bool anyPass = false;
+
+    for (std::size_t config = 0; config < cutConfigs.size(); config++)
+    {
+        int failed = AlphaCutFailed(cutConfigs[config], alphaEnergy, alphaPSD);
+
+        // The cut flow follows the nominal cuts
+        if (config == 0)
+            counts[0].cutFlow.alpha[failed]++;
+
+        alphaPass[config] = (failed == AlphaPassed);
+        anyPass |= alphaPass[config];
+    }
+
+    return anyPass;
+}
+
+// Takes an alpha that isn't read from a tree or a cache, for FillBeta to be called on its betas
+bool BiPo::SetAlpha(int segment, double energy, double psd, double z)
+{
+    alphaSegment = segment;
+    alphaEnergy = energy;
+    alphaPSD = psd;
+    alphaZ = z;
+
+    return PassAlphaCuts();
+}
+
+void BiPo::CalculateDisplacement(int betaSegment, float betaZ)
+{
+    // Alpha location
+    alphaX = Segment(alphaSegment).x;
+    alphaY = Segment(alphaSegment).y;
+
+    // Beta location
+    betaX = Segment(betaSegment).x;
+    betaY = Segment(betaSegment).y;
+
+    // Calculating prompt - delayed displacement
+    dx = 145.7 * (alphaX - betaX);
+    dy = 145.7 * (alphaY - betaY);
+    dz = alphaZ - betaZ;
+}
+
+void BiPo::FillSelected(int signalSet, int j, int betaSegment, std::size_t config, float betaEnergy)
+{
+    FillSignals(counts[config].signals, signalSet, j, betaSegment);
+
+    // The binned counts follow the nominal cuts
+    if (config != 0 || binnedCounts.empty())
+        return;
+
+    int cell = BinnedCell(betaEnergy, std::sqrt(dx * dx + dy * dy + dz * dz));
+
+    if (cell >= 0)
+        FillSignals(binnedCounts[cell], signalSet, j, betaSegment);
+}
+
+void BiPo::FillSignals(RunSignals& target, int signalSet, int j, int betaSegment)
+{
+    if (signalSet == Correlated)
+    {
+        if (alphaSegment == betaSegment + 1 || alphaSegment == betaSegment - 1)
+            target[Data][Correlated].x.Fill(dx);
+
+        if (alphaSegment == betaSegment + 14 || alphaSegment == betaSegment - 14)
+            target[Data][Correlated].y.Fill(dy);
+
+        if (alphaSegment == betaSegment)
+        {
+            target[Data][Correlated].x.Fill(0.0);
+            target[Data][Correlated].y.Fill(0.0);
+            target[Data][Correlated].z.Fill(dz);
+            FillHistogramUnbiased(Correlated, target);
+        }
+
+        target[Data][Correlated].multiplicity.Fill(j + 1);
+    }
+    else
+    {
+        // Need to weight accidental datasets by deadtime correction factor
+        if (alphaSegment == betaSegment + 1 || alphaSegment == betaSegment - 1)
+            target[Data][Accidental].x.Fill(dx, settings.n2f);
+
+        if (alphaSegment == betaSegment + 14 || alphaSegment == betaSegment - 14)
+            target[Data][Accidental].y.Fill(dy, settings.n2f);
+
+        if (alphaSegment == betaSegment)
+        {
+            target[Data][Accidental].x.Fill(0.0, settings.n2f);
+            target[Data][Accidental].y.Fill(0.0, settings.n2f);
+            target[Data][Accidental].z.Fill(dz, settings.n2f);
+            FillHistogramUnbiased(Accidental, target);
+        }
+
+        target[Data][Accidental].multiplicity.Fill(j + 1, settings.n2f);
+    }
+}
+
+void BiPo::FillHistogramUnbiased(int signalSet, RunSignals& target)
+{
+    bool posDirectionX = false, negDirectionX = false;
+    bool posDirectionY = false, negDirectionY = false;
+
+    // Need to weight accidental datasets by deadtime correction factor
+    double weight = (signalSet == Accidental) ? settings.n2f : 1;
+
+    // Check for live neighbors in different directions
+    SegmentInfo const& segment = Segment(alphaSegment);
+    posDirectionX = segment.Neighbor(NeighborRight);
+    negDirectionX = segment.Neighbor(NeighborLeft);
+    posDirectionY = segment.Neighbor(NeighborUp);
+    negDirectionY = segment.Neighbor(NeighborDown);
+
+    // Filling x axis
+    if (posDirectionX && !negDirectionX)
+        target[DataUnbiased][signalSet].x.Fill(segmentWidth, weight);
+    else if (!posDirectionX && negDirectionX)
+        target[DataUnbiased][signalSet].x.Fill(-segmentWidth, weight);
+    else if (posDirectionX && negDirectionX)
+        target[DataUnbiased][signalSet].x.Fill(0.0, weight);
+
+    // Filling y axis
+    if (posDirectionY && !negDirectionY)
+        target[DataUnbiased][signalSet].y.Fill(segmentWidth, weight);
+    else if (!posDirectionY && negDirectionY)
+        target[DataUnbiased][signalSet].y.Fill(-segmentWidth, weight);
+    else if (posDirectionY && negDirectionY)
+        target[DataUnbiased][signalSet].y.Fill(0.0, weight);
+
+    // Filling z axis
+    target[DataUnbiased][signalSet].z.Fill(dz, weight);
+}
+
+void BiPo::TransferCounts()
+{
+    // The fill loop only touches the flat counts, this is where they become ROOT histograms
+    for (int dataset = Data; dataset < DatasetSize; dataset++)
+    {
+        for (int signalSet = Correlated; signalSet < TotalDifference; signalSet++)
+        {
+            SignalCounts const& signalCounts = counts[activeConfig][dataset][signalSet];
+
+            signalCounts.x.CopyTo(histogram[dataset][signalSet][X]);
+            signalCounts.y.CopyTo(histogram[dataset][signalSet][Y]);
+            signalCounts.z.CopyTo(histogram[dataset][signalSet][Z]);
+            signalCounts.multiplicity.CopyTo(multiplicity[dataset][signalSet]);
+        }
+    }
+}
+
+void BiPo::SubtractBackgrounds()
+{
+    ProfileScope scope("Subtract backgrounds");
+
+    TransferCounts();
+
+    for (int dataset = Data; dataset < DatasetSize; dataset++)
+    {
+        for (int direction = X; direction < DirectionSize; direction++)
+        {
+            string histogramName;
+            string data = DatasetToString(dataset);
+            histogramName = data + " Total Difference " + AxisToString(direction);
+
+            // Copying Correlated to start
+            histogram[dataset][TotalDifference][direction] = TH1D(histogram[dataset][Correlated][direction]);
+
+            histogram[dataset][TotalDifference][direction].SetNameTitle(histogramName.c_str(), data.c_str());
+
+            histogram[dataset][TotalDifference][direction].Add(&histogram[dataset][Accidental][direction], -1.0);
+
+            if (dataset == DataUnbiased || direction == Z)
+                continue;
+
+            mean[dataset][direction] = histogram[dataset][TotalDifference][direction].GetMean();
+
+            float effEntries = histogram[dataset][TotalDifference][direction].GetEntries();
+            sigma[dataset][direction] = histogram[dataset][TotalDifference][direction].GetStdDev() / sqrt(effEntries);
+        }
+
+        // Z is fit to a Guassian and only takes same segment inputs
+        // Possible thanks to 1mm resolution in Z
+        TF1 gaussian("Fit", "gaus", -250, 250);
+
+        ProfileScope fit("Z fit");
+        histogram[dataset][TotalDifference][Z].Fit(&gaussian, "RQ");
+        fit.Close();
+
+        float zMean = gaussian.GetParameter(1);
+        float zError = gaussian.GetParError(1);
+
+        mean[dataset][Z] = zMean;
+        sigma[dataset][Z] = zError;
+
+        // Deleting fit because we don't want the plot options stuck here
+        delete histogram[dataset][TotalDifference][Z].GetListOfFunctions()->FindObject("Fit");
+
+        // Multiplicity background subtraction
+        string histogramName;
+        string data = DatasetToString(dataset);
+        histogramName = "Multiplicity " + data + " Total Difference";
+
+        multiplicity[dataset][TotalDifference] = TH1I(multiplicity[dataset][Correlated]);
+        multiplicity[dataset][TotalDifference].SetNameTitle(histogramName.c_str(), data.c_str());
+        multiplicity[dataset][TotalDifference].Add(&multiplicity[dataset][Accidental], -1.0);
+    }
+}
+
+UnbiasingCounts BiPo::UnbiasingInput(int signalSet, int direction) const
+{
+    // Grabbing data from filled bins, rest should be empty
+    UnbiasingCounts unbiasing;
+    std::array<std::pair<int, int>, UnbiasingBinSize> bins
+        = {{{Data, 297}, {Data, 5}, {DataUnbiased, 297}, {DataUnbiased, 5}, {DataUnbiased, 151}}};
+
+    for (int bin = BinPlus; bin < UnbiasingBinSize; bin++)
+    {
+        TH1D const& source = histogram[bins[bin].first][signalSet][direction];
+
+        unbiasing.n[bin] = source.GetBinContent(bins[bin].second);
+        unbiasing.error[bin] = source.GetBinError(bins[bin].second);
+    }
+
+    return unbiasing;
+}
+
+void BiPo::CalculateUnbiasing()
+{
+    ProfileScope scope("Unbiasing");
+
+    // The estimator itself is in Unbiasing.h, where the toy validation uses it too
+    double p = 0, pError = 0;
+
+    for (int direction = X; direction < Z; direction++)
+    {
+        UnbiasingCounts unbiasing = UnbiasingInput(TotalDifference, direction);
+
+        UnbiasedMean(unbiasing, segmentWidth, p, pError);
 
         mean[DataUnbiased][direction] = p;
         sigma[DataUnbiased][direction] = pError;
 
-        if (NCOUNT_VERBOSITY)
+        if (NCOUNT_VERBOSITY && !quiet)
+        {
+            cout << "N counts for: " << boldOn << "Data Unbiased " << AxisToString(direction) << '\n';
+            cout << "N+: " << resetFormats << unbiasing.n[BinPlus] << '\n';
+            cout << boldOn << "N-: " << resetFormats << unbiasing.n[BinMinus] << '\n';
+            cout << boldOn << "N++: " << resetFormats << unbiasing.n[BinPlusPlus] << '\n';
+            cout << boldOn << "N--: " << resetFormats << unbiasing.n[BinMinusMinus] << '\n';
+            cout << boldOn << "N+-: " << resetFormats << unbiasing.n[BinPlusMinus] << '\n';
+            cout << "--------------------------------------------\n";
+        }
+    }
+
+    mean[DataUnbiased][Z] = mean[Data][Z];
+    sigma[DataUnbiased][Z] = sigma[Data][Z];
+
+    if (quiet)
+        return;
+
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Calculated Means.\n" << resetFormats;
+    cout << "--------------------------------------------\n";
+
+    // Printing out values
+    for (int dataset = Data; dataset < DatasetSize; dataset++)
+    {
+        cout << "Mean and sigma values for: " << boldOn << DatasetToString(dataset) << resetFormats << '\n';
+        for (int direction = X; direction < DirectionSize; direction++)
+        {
+            cout << boldOn << "p" << AxisToString(direction) << ": " << resetFormats << mean[dataset][direction] << " ± "
+                 << sigma[dataset][direction] << '\n';
+        }
+        cout << "--------------------------------------------\n";
+    }
+}
+
+void BiPo::CalculateAngles()
+{
+    ProfileScope scope("Angles");
+
+    // Defining variables for readability of code
+    double px, py, pz;
+    double sigmaX, sigmaY, sigmaZ;
+
+    for (int dataset = Data; dataset < DatasetSize; dataset++)
+    {
+        // Grabbing values from current dataset
+        px = mean[dataset][X];
+        py = mean[dataset][Y];
+        pz = mean[dataset][Z];
+
+        sigmaX = sigma[dataset][X];
+        sigmaY = sigma[dataset][Y];
+        sigmaZ = sigma[dataset][Z];
+
+        // phi = arctan(y / x)
+        float tanPhi = py / px;
+        float phiTemp = atan(tanPhi) * 180.0 / pi;
+        float tanPhiError = sqrt(pow((sigmaX * py) / pow(px, 2), 2) + pow(sigmaY / px, 2));
+        float phiErrorTemp = (tanPhiError / (1 + pow(tanPhi, 2))) * 180.0 / pi;
+
+        // theta = arctan(z / sqrt(x^2 + y^2))
+        float tanTheta = pz / sqrt(pow(px, 2) + pow(py, 2));
+        float thetaTemp = atan(tanTheta) * 180.0 / pi;
+        float tanThetaError = sqrt((1 / (px * px + py * py))
+                                   * (pow((px * pz * sigmaX / (px * px + py * py)), 2)
+                                      + pow((py * pz * sigmaY / (px * px + py * py)), 2) + pow(sigmaZ, 2)));
+        float thetaErrorTemp = (tanThetaError / (1 + pow(tanTheta, 2))) * 180.0 / pi;
+
+        // Storing values
+        phi[dataset] = phiTemp;
+        phiError[dataset] = phiErrorTemp;
+        theta[dataset] = thetaTemp;
+        thetaError[dataset] = thetaErrorTemp;
+    }
+}
+
+void BiPo::OffsetTheta()
+{
+    for (int dataset = Data; dataset < DatasetSize; dataset++)
+    {
+        theta[dataset] = 90 - theta[dataset];
+    }
+}
+
+void BiPo::PrintAngles()
+{
+    cout << boldOn << cyanOn << "Final Angles!\n" << resetFormats;
+    cout << "--------------------------------------------\n";
+
+    for (int dataset = Data; dataset < DatasetSize; dataset++)
+    {
+        cout << "Angle values for: " << boldOn << DatasetToString(dataset) << resetFormats << '\n';
+        cout << greenOn;
+        cout << boldOn << underlineOn << "ϕ:" << resetFormats << greenOn << " " << phi[dataset] << "\u00B0 ± "
+             << phiError[dataset] << "\u00B0.\n";
+        cout << boldOn << underlineOn << "θ:" << resetFormats << greenOn << " " << theta[dataset] << "\u00B0 ± "
+             << thetaError[dataset] << "\u00B0.\n"
+             << resetFormats;
+        cout << "--------------------------------------------\n";
+    }
+}
+
+void BiPo::Resample()
+{
+    if (!Resampling())
+        return;
+
+    ProfileScope scope("Resample");
+
+    std::size_t runCount = runPartials.size();
+
+    if (runCount < 2)
+    {
+        cout << "Resampling needs the counts of at least two runs, shard outputs only hold their totals.\n";
+        cout << "--------------------------------------------\n";
+        return;
+    }
+
+    // Runs in list order, so the jackknife blocks don't depend on which worker read which run
+    vector<std::size_t> order(runCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](std::size_t a, std::size_t b) { return partialRuns[a] < partialRuns[b]; });
+
+    std::ofstream replicaFile("BiPoReplicas.txt");
+    replicaFile << "# mode replica px py pz phi theta (Data) px py pz phi theta (Data Unbiased)\n";
+
+    auto report = [&](vector<Estimates> const& values, string const& mode, bool jackknife)
+    {
+        for (std::size_t replica = 0; replica < values.size(); replica++)
+        {
+            replicaFile << mode << ' ' << replica;
+
+            for (int dataset = Data; dataset < DatasetSize; dataset++)
+            {
+                for (double value : values[replica][dataset])
+                {
+                    replicaFile << ' ' << value;
+                }
+            }
+
+            replicaFile << '\n';
+        }
+
+        for (int dataset = Data; dataset < DatasetSize; dataset++)
+        {
+            cout << "Errors for: " << boldOn << DatasetToString(dataset) << resetFormats << '\n';
+
+            for (int estimate = 0; estimate < estimates; estimate++)
+            {
+                vector<double> replicaValues(values.size());
+
+                for (std::size_t replica = 0; replica < values.size(); replica++)
+                {
+                    replicaValues[replica] = values[replica][dataset][estimate];
+                }
+
+                string label;
+                double value, analytic;
+
+                if (estimate < DirectionSize)
+                {
+                    label = "p" + AxisToString(estimate);
+                    value = mean[dataset][estimate];
+                    analytic = sigma[dataset][estimate];
+                }
+                else if (estimate == DirectionSize)
+                {
+                    label = "ϕ";
+                    value = phi[dataset];
+                    analytic = phiError[dataset];
+                }
+                else
+                {
+                    label = "θ";
+                    value = theta[dataset];
+                    analytic = thetaError[dataset];
+                }
+
+                cout << boldOn << label << ": " << resetFormats << value << " ± " << analytic << " analytic, ± "
+                     << ResampledSpread(replicaValues, jackknife) << ' ' << mode << '\n';
+            }
+
+            cout << "--------------------------------------------\n";
+        }
+    };
+
+    if (BOOTSTRAP_REPLICAS > 0)
+    {
+        cout << boldOn << cyanOn << "Bootstrap over " << runCount << " runs, " << BOOTSTRAP_REPLICAS << " replicas.\n"
+             << resetFormats;
+        cout << "--------------------------------------------\n";
+
+        vector<Estimates> values = EvaluateParallel(BOOTSTRAP_REPLICAS, "Bootstrap",
+                                                    [&](std::size_t replica, RunSignals& sum)
+                                                    {
+                                                        vector<int> times;
+                                                        BootstrapMultiplicities(runCount, replica, times);
+
+                                                        sum = RunSignals();
+
+                                                        for (std::size_t i = 0; i < runCount; i++)
+                                                        {
+                                                            if (times[i] > 0)
+                                                                AddSignals(sum, runPartials[order[i]], times[i]);
+                                                        }
+                                                    });
+
+        report(values, "bootstrap", false);
+    }
+
+    if (JACKKNIFE_BLOCKS > 0)
+    {
+        std::size_t blocks = std::min<std::size_t>(JACKKNIFE_BLOCKS, runCount);
+
+        cout << boldOn << cyanOn << "Jackknife over " << runCount << " runs, " << blocks << " blocks left out in turn.\n"
+             << resetFormats;
+        cout << "--------------------------------------------\n";
+
+        // Every replica is the total less one block, so each block is only summed once
+        vector<RunSignals> blockSums(blocks);
+        auto total = std::make_unique<RunSignals>();
+
+        ForEachParallel(blocks, std::max<int>(WORKER_COUNT, std::thread::hardware_concurrency()),
+                        [&](std::size_t block)
+                        {
+                            auto [first, last] = JackknifeBlock(block, blocks, runCount);
+
+                            for (std::size_t i = first; i < last; i++)
+                            {
+                                AddSignals(blockSums[block], runPartials[order[i]], 1);
+                            }
+                        });
+
+        for (RunSignals const& blockSum : blockSums)
+        {
+            AddSignals(*total, blockSum, 1);
+        }
+
+        vector<Estimates> values = EvaluateParallel(blocks, "Jackknife",
+                                                    [&](std::size_t block, RunSignals& sum)
+                                                    {
+                                                        sum = *total;
+                                                        AddSignals(sum, blockSums[block], -1);
+                                                    });
+
+        report(values, "jackknife", true);
+    }
+
+    cout << boldOn << cyanOn << "Wrote replicas: " << resetFormats << blueOn << boldOn << "BiPoReplicas.txt!\n"
+         << resetFormats;
+    cout << "--------------------------------------------\n";
+}
+
+void BiPo::AnalyzeSlices()
+{
+    if (SLICE_SECONDS == 0)
+        return;
+
+    ProfileScope scope("Time slices");
+
+    if (slices.empty())
+    {
+        cout << "No time slices, none of the runs had a timestamp or shard outputs were merged.\n";
+        cout << "--------------------------------------------\n";
+        return;
+    }
+
+    // Slices in time order, each one goes through the same chain as the whole dataset
+    vector<long long> numbers;
+    vector<Slice const*> ordered;
+
+    for (auto const& [number, slice] : slices)
+    {
+        numbers.push_back(number);
+        ordered.push_back(&slice);
+    }
+
+    vector<Estimates> errors;
+    vector<Estimates> values = EvaluateParallel(
+        ordered.size(), "Slice", [&](std::size_t item, RunSignals& sum) { sum = ordered[item]->signals; }, &errors);
+
+    cout << boldOn << cyanOn << "Time slices of " << SLICE_SECONDS << " s: " << resetFormats << ordered.size()
+         << " with runs";
+
+    if (unslicedRuns > 0)
+        cout << ", " << unslicedRuns << " runs without a timestamp are only in the total";
+
+    cout << ".\n";
+    cout << "--------------------------------------------\n";
+
+    std::ofstream sliceFile("BiPoSlices.txt");
+    sliceFile << "# start end runs, then value and error of px py pz phi theta (Data) and the same (Data Unbiased)\n";
+
+    for (std::size_t item = 0; item < ordered.size(); item++)
+    {
+        long long start = sliceOrigin + numbers[item] * SLICE_SECONDS;
+        Estimates const& value = values[item];
+        Estimates const& error = errors[item];
+
+        sliceFile << start << ' ' << start + SLICE_SECONDS << ' ' << ordered[item]->runs;
+
+        for (int dataset = Data; dataset < DatasetSize; dataset++)
         {
-            cout << "N counts for: " << boldOn << "Data Unbiased " << AxisToString(direction) << '\n';
-            cout << "N+: " << resetFormats << nPlus << '\n';
-            cout << boldOn << "N-: " << resetFormats << nMinus << '\n';
-            cout << boldOn << "N++: " << resetFormats << nPlusPlus << '\n';
-            cout << boldOn << "N--: " << resetFormats << nMinusMinus << '\n';
-            cout << boldOn << "N+-: " << resetFormats << nPlusMinus << '\n';
-            cout << "--------------------------------------------\n";
+            for (int estimate = 0; estimate < estimates; estimate++)
+            {
+                sliceFile << ' ' << value[dataset][estimate] << ' ' << error[dataset][estimate];
+            }
         }
+
+        sliceFile << '\n';
+
+        int phiIndex = DirectionSize, thetaIndex = DirectionSize + 1;
+
+        cout << boldOn << FormatTimestamp(start) << resetFormats << " (" << ordered[item]->runs << " runs): ϕ = "
+             << value[Data][phiIndex] << "\u00B0 ± " << error[Data][phiIndex] << "\u00B0, θ = " << value[Data][thetaIndex]
+             << "\u00B0 ± " << error[Data][thetaIndex] << "\u00B0 (unbiased ϕ = " << value[DataUnbiased][phiIndex]
+             << "\u00B0 ± " << error[DataUnbiased][phiIndex] << "\u00B0, θ = " << value[DataUnbiased][thetaIndex]
+             << "\u00B0 ± " << error[DataUnbiased][thetaIndex] << "\u00B0)\n";
     }
 
-    mean[DataUnbiased][Z] = mean[Data][Z];
-    sigma[DataUnbiased][Z] = sigma[Data][Z];
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Wrote time slices: " << resetFormats << blueOn << boldOn << "BiPoSlices.txt!\n"
+         << resetFormats;
+    cout << "--------------------------------------------\n";
+}
+
+void BiPo::SetUpBinning()
+{
+    binnedCounts.clear();
+
+    if (ENERGY_BINS.empty() && DISPLACEMENT_BINS.empty())
+        return;
+
+    // A dimension that isn't binned is one bin over the whole cut range
+    CutConfig const& cuts = NominalCuts();
+    energyEdges = ReadBinEdges(ENERGY_BINS.empty() ? "1" : ENERGY_BINS, cuts.lowBetaEnergy, cuts.highBetaEnergy);
+    displacementEdges = ReadBinEdges(DISPLACEMENT_BINS.empty() ? "1" : DISPLACEMENT_BINS, 0, cuts.maxDisplacement);
+
+    if (energyEdges.empty() || displacementEdges.empty())
+    {
+        cout << "Not binning the beta energy and displacement.\n";
+        return;
+    }
+
+    binnedCounts.resize((energyEdges.size() - 1) * (displacementEdges.size() - 1));
+}
+
+void BiPo::AnalyzeBins()
+{
+    if (binnedCounts.empty())
+        return;
+
+    ProfileScope scope("Bins");
+
+    // Every energy bin over all displacements, every displacement bin over all energies, then the single cells when
+    // both are binned
+    std::size_t energyBins = energyEdges.size() - 1, displacementBins = displacementEdges.size() - 1;
+    vector<vector<std::size_t>> cells;
+    vector<std::array<std::size_t, 2>> energyRange, displacementRange;
+
+    auto add = [&](std::size_t firstEnergy, std::size_t lastEnergy, std::size_t firstDistance, std::size_t lastDistance)
+    {
+        cells.emplace_back();
+
+        for (std::size_t energy = firstEnergy; energy < lastEnergy; energy++)
+        {
+            for (std::size_t distance = firstDistance; distance < lastDistance; distance++)
+            {
+                cells.back().push_back(energy * displacementBins + distance);
+            }
+        }
 
+        energyRange.push_back({firstEnergy, lastEnergy});
+        displacementRange.push_back({firstDistance, lastDistance});
+    };
+
+    for (std::size_t energy = 0; energy < energyBins && energyBins > 1; energy++)
+    {
+        add(energy, energy + 1, 0, displacementBins);
+    }
+
+    for (std::size_t distance = 0; distance < displacementBins && displacementBins > 1; distance++)
+    {
+        add(0, energyBins, distance, distance + 1);
+    }
+
+    for (std::size_t cell = 0; cell < binnedCounts.size() && energyBins > 1 && displacementBins > 1; cell++)
+    {
+        add(cell / displacementBins, cell / displacementBins + 1, cell % displacementBins, cell % displacementBins + 1);
+    }
+
+    vector<Estimates> errors;
+    vector<Estimates> values = EvaluateParallel(
+        cells.size(), "Bin",
+        [&](std::size_t item, RunSignals& sum)
+        {
+            sum = RunSignals();
+
+            for (std::size_t cell : cells[item])
+            {
+                AddSignals(sum, binnedCounts[cell], 1);
+            }
+        },
+        &errors);
+
+    cout << boldOn << cyanOn << "Binned directionality: " << resetFormats << energyBins << " beta energy and "
+         << displacementBins << " displacement bins.\n";
     cout << "--------------------------------------------\n";
-    cout << boldOn << cyanOn << "Calculated Means.\n" << resetFormats;
+
+    std::ofstream binFile("BiPoBins.txt");
+    binFile << "# lowEnergy highEnergy lowDisplacement highDisplacement, then value and error of px py pz phi theta "
+               "(Data) and the same (Data Unbiased)\n";
+
+    for (std::size_t item = 0; item < cells.size(); item++)
+    {
+        float lowEnergy = energyEdges[energyRange[item][0]], highEnergy = energyEdges[energyRange[item][1]];
+        float lowDistance = displacementEdges[displacementRange[item][0]];
+        float highDistance = displacementEdges[displacementRange[item][1]];
+        Estimates const& value = values[item];
+        Estimates const& error = errors[item];
+
+        binFile << lowEnergy << ' ' << highEnergy << ' ' << lowDistance << ' ' << highDistance;
+
+        for (int dataset = Data; dataset < DatasetSize; dataset++)
+        {
+            for (int estimate = 0; estimate < estimates; estimate++)
+            {
+                binFile << ' ' << value[dataset][estimate] << ' ' << error[dataset][estimate];
+            }
+        }
+
+        binFile << '\n';
+
+        int phiIndex = DirectionSize, thetaIndex = DirectionSize + 1;
+
+        cout << boldOn << lowEnergy << "-" << highEnergy << " MeV, " << lowDistance << "-" << highDistance << " mm: "
+             << resetFormats << "ϕ = " << value[Data][phiIndex] << "\u00B0 ± " << error[Data][phiIndex] << "\u00B0, θ = "
+             << value[Data][thetaIndex] << "\u00B0 ± " << error[Data][thetaIndex] << "\u00B0 (unbiased ϕ = "
+             << value[DataUnbiased][phiIndex] << "\u00B0 ± " << error[DataUnbiased][phiIndex] << "\u00B0, θ = "
+             << value[DataUnbiased][thetaIndex] << "\u00B0 ± " << error[DataUnbiased][thetaIndex] << "\u00B0)\n";
+    }
+
     cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Wrote binned directionality: " << resetFormats << blueOn << boldOn << "BiPoBins.txt!\n"
+         << resetFormats;
+    cout << "--------------------------------------------\n";
+}
+
+vector<BiPo::Estimates> BiPo::EvaluateParallel(std::size_t count, string const& name,
+                                               std::function<void(std::size_t, RunSignals&)> const& build,
+                                               vector<Estimates>* errors)
+{
+    // TMinuit keeps global state, Minuit2 can fit from several threads at once. The default is process wide, so it's
+    // put back once the threads are done and the fits outside the replicas keep the minimizer they had
+    string previousMinimizer = ROOT::Math::MinimizerOptions::DefaultMinimizerType();
+    string previousAlgorithm = ROOT::Math::MinimizerOptions::DefaultMinimizerAlgo();
+    ROOT::Math::MinimizerOptions::SetDefaultMinimizer("Minuit2");
+
+    // Each thread sums its counts into its own buffer and runs the usual chain on its own copy of the analysis
+    vector<Estimates> values(count);
+    vector<std::unique_ptr<BiPo>> evaluators;
+    std::atomic<std::size_t> next = 0;
+    vector<std::thread> threads;
+    int threadCount = std::min<int>(std::max<int>(WORKER_COUNT, std::thread::hardware_concurrency()), count);
+
+    if (errors)
+        errors->resize(count);
+
+    for (int thread = 0; thread < threadCount; thread++)
+    {
+        evaluators.push_back(std::make_unique<BiPo>());
+        evaluators.back()->settings = settings;
+        evaluators.back()->skimCache.reset();
+        evaluators.back()->quiet = true;
+    }
+
+    for (int thread = 0; thread < threadCount; thread++)
+    {
+        threads.emplace_back(
+            [&, thread]()
+            {
+                Profiler::Get().NameThread(name + " " + std::to_string(thread));
+                auto sum = std::make_unique<RunSignals>();
+
+                for (std::size_t item = next++; item < count; item = next++)
+                {
+                    build(item, *sum);
+                    values[item] = evaluators[thread]->EvaluateReplica(*sum, errors ? &(*errors)[item] : nullptr);
+                }
+            });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    ROOT::Math::MinimizerOptions::SetDefaultMinimizer(previousMinimizer.c_str(), previousAlgorithm.c_str());
+
+    return values;
+}
+
+BiPo::Estimates BiPo::EvaluateReplica(RunSignals const& replica, Estimates* errors)
+{
+    counts[0].signals = replica;
+
+    SubtractBackgrounds();
+    CalculateUnbiasing();
+    CalculateAngles();
+    OffsetTheta();
+
+    Estimates values;
 
-    // Printing out values
     for (int dataset = Data; dataset < DatasetSize; dataset++)
     {
-        cout << "Mean and sigma values for: " << boldOn << DatasetToString(dataset) << resetFormats << '\n';
         for (int direction = X; direction < DirectionSize; direction++)
         {
-            cout << boldOn << "p" << AxisToString(direction) << ": " << resetFormats << mean[dataset][direction] << " ± "
-                 << sigma[dataset][direction] << '\n';
+            values[dataset][direction] = mean[dataset][direction];
         }
-        cout << "--------------------------------------------\n";
+
+        values[dataset][DirectionSize] = phi[dataset];
+        values[dataset][DirectionSize + 1] = theta[dataset];
+
+        if (!errors)
+            continue;
+
+        for (int direction = X; direction < DirectionSize; direction++)
+        {
+            (*errors)[dataset][direction] = sigma[dataset][direction];
+        }
+
+        (*errors)[dataset][DirectionSize] = phiError[dataset];
+        (*errors)[dataset][DirectionSize + 1] = thetaError[dataset];
     }
+
+    return values;
 }
 
-void BiPo::CalculateAngles()
+void BiPo::ValidateUnbiasing()
 {
-    // Defining variables for readability of code
-    double px, py, pz;
-    double sigmaX, sigmaY, sigmaZ;
+    if (TOY_COUNT <= 0)
+        return;
 
-    for (int dataset = Data; dataset < DatasetSize; dataset++)
+    ProfileScope scope("Toys");
+
+    // Rates of the whole dataset and of smaller ones, down to what a short slice of it would see
+    constexpr std::array<double, 4> scales = {1, 1.0 / 4, 1.0 / 16, 1.0 / 64};
+    int threadCount = std::max<int>(WORKER_COUNT, std::thread::hardware_concurrency());
+
+    cout << boldOn << cyanOn << "Unbiasing toys: " << resetFormats << TOY_COUNT << " per direction and rate.\n";
+    cout << "--------------------------------------------\n";
+
+    TFile toyFile("BiPoToys.root", "recreate");
+
+    for (int direction = X; direction < Z; direction++)
     {
-        // Grabbing values from current dataset
-        px = mean[dataset][X];
-        py = mean[dataset][Y];
-        pz = mean[dataset][Z];
+        // Correlated counts are unit weight, the accidental ones were filled with weight n2f
+        UnbiasingCounts correlated = UnbiasingInput(Correlated, direction);
+        UnbiasingCounts accidental = UnbiasingInput(Accidental, direction);
 
-        sigmaX = sigma[dataset][X];
-        sigmaY = sigma[dataset][Y];
-        sigmaZ = sigma[dataset][Z];
+        for (std::size_t point = 0; point < scales.size(); point++)
+        {
+            double scale = scales[point];
+            ToyRates rates;
+            rates.n2f = settings.n2f;
+            rates.segmentWidth = segmentWidth;
 
-        // phi = arctan(y / x)
-        float tanPhi = py / px;
-        float phiTemp = atan(tanPhi) * 180.0 / pi;
-        float tanPhiError = sqrt(pow((sigmaX * py) / pow(px, 2), 2) + pow(sigmaY / px, 2));
-        float phiErrorTemp = (tanPhiError / (1 + pow(tanPhi, 2))) * 180.0 / pi;
+            for (int bin = BinPlus; bin < UnbiasingBinSize; bin++)
+            {
+                rates.correlated[bin] = scale * correlated.n[bin];
+                rates.accidental[bin] = scale * accidental.n[bin] / settings.n2f;
+            }
 
-        // theta = arctan(z / sqrt(x^2 + y^2))
-        float tanTheta = pz / sqrt(pow(px, 2) + pow(py, 2));
-        float thetaTemp = atan(tanTheta) * 180.0 / pi;
-        float tanThetaError = sqrt((1 / (px * px + py * py))
-                                   * (pow((px * pz * sigmaX / (px * px + py * py)), 2)
-                                      + pow((py * pz * sigmaY / (px * px + py * py)), 2) + pow(sigmaZ, 2)));
-        float thetaErrorTemp = (tanThetaError / (1 + pow(tanTheta, 2))) * 180.0 / pi;
+            ToyResult result = ThrowToys(rates, TOY_COUNT, threadCount, direction * scales.size() + point);
 
-        // Storing values
-        phi[dataset] = phiTemp;
-        phiError[dataset] = phiErrorTemp;
-        theta[dataset] = thetaTemp;
-        thetaError[dataset] = thetaErrorTemp;
+            std::ostringstream label;
+            label << "Unbiasing Pull " << AxisToString(direction) << " x" << scale;
+
+            TH1D pulls(label.str().c_str(), label.str().c_str(), PullAxis::bins, PullAxis::min, PullAxis::max);
+            result.pulls.CopyTo(pulls);
+            pulls.Write();
+
+            cout << boldOn << "p" << AxisToString(direction) << " at " << scale << " of the counts: " << resetFormats
+                 << "pull " << result.PullMean() << " ± " << result.PullWidth() << ", "
+                 << 100.0 * result.withinOne / std::max(result.Used(), 1LL) << " % within 1σ (68.3), "
+                 << 100.0 * result.withinTwo / std::max(result.Used(), 1LL) << " % within 2σ (95.4)";
+
+            if (result.failed > 0)
+                cout << ", " << result.failed << " toys without a result";
+
+            cout << '\n';
+        }
     }
+
+    toyFile.Close();
+
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Wrote toy pulls: " << resetFormats << blueOn << boldOn << "BiPoToys.root!\n"
+         << resetFormats;
+    cout << "--------------------------------------------\n";
 }
 
-void BiPo::OffsetTheta()
+void BiPo::PrintCutFlow()
 {
-    for (int dataset = Data; dataset < DatasetSize; dataset++)
+    CutFlow const& flow = counts[0].cutFlow;
+
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Cut flow for the nominal cuts.\n" << resetFormats;
+    cout << "--------------------------------------------\n";
+
+    if (eventCache)
+        cout << "Fiducial, |z| and cluster cuts were applied by the skim and aren't counted.\n";
+
+    // The builder only opens coincidences for clusters inside the loosest alpha cuts, every other cluster is a beta
+    if (!SINGLES_FILE_NAME.empty())
+        cout << "Built from singles: alphas are the clusters inside the loosest alpha energy and PSD cuts of all "
+                "configurations, betas every cluster in the widest windows.\n";
+
+    // Each cut line is what the cut rejected, out of what reached it. The passed line is out of every candidate
+    long long total = 0;
+
+    for (int cut = 0; cut < AlphaCutSize; cut++)
     {
-        theta[dataset] = 90 - theta[dataset];
+        total += flow.alpha[cut];
+    }
+
+    long long remaining = total;
+
+    cout << boldOn << "Alphas: " << resetFormats << total << '\n';
+
+    for (int cut = 0; cut < AlphaCutSize; cut++)
+    {
+        long long reached = (cut == AlphaPassed) ? total : remaining;
+
+        cout << "  " << std::left << std::setw(22) << AlphaCutToString(cut) << std::right << std::setw(14)
+             << flow.alpha[cut] << std::setw(10) << std::fixed << std::setprecision(2)
+             << (reached > 0 ? 100.0 * flow.alpha[cut] / reached : 0) << " %\n"
+             << std::defaultfloat << std::setprecision(6);
+        remaining -= flow.alpha[cut];
+    }
+
+    for (int signalSet = Correlated; signalSet < TotalDifference; signalSet++)
+    {
+        total = 0;
+
+        for (int cut = 0; cut < BetaCutSize; cut++)
+        {
+            total += flow.beta[signalSet][cut];
+        }
+
+        remaining = total;
+
+        string window = (signalSet == Correlated) ? "Prompt" : "Far";
+        cout << boldOn << window << " betas of passing alphas: " << resetFormats << total << '\n';
+
+        for (int cut = 0; cut < BetaCutSize; cut++)
+        {
+            if (cut == BetaDz && signalSet == Correlated)
+                continue;
+
+            long long reached = (cut == BetaPassed) ? total : remaining;
+
+            cout << "  " << std::left << std::setw(22) << BetaCutToString(cut) << std::right << std::setw(14)
+                 << flow.beta[signalSet][cut] << std::setw(10) << std::fixed << std::setprecision(2)
+                 << (reached > 0 ? 100.0 * flow.beta[signalSet][cut] / reached : 0) << " %\n"
+                 << std::defaultfloat << std::setprecision(6);
+            remaining -= flow.beta[signalSet][cut];
+        }
     }
+
+    cout << "--------------------------------------------\n";
 }
 
-void BiPo::PrintAngles()
+void BiPo::RunCutScan()
 {
-    cout << boldOn << cyanOn << "Final Angles!\n" << resetFormats;
+    ProfileScope scope("Cut scan");
+
+    if (cutConfigs.size() < 2)
+        return;
+
+    std::ofstream scanFile("BiPoCutScan.txt");
+    scanFile << "# config phi phiError theta thetaError (Data) phi phiError theta thetaError (Data Unbiased) cuts\n";
+
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Cut scan results.\n" << resetFormats;
     cout << "--------------------------------------------\n";
 
-    for (int dataset = Data; dataset < DatasetSize; dataset++)
+    // Every scan point goes through the same chain as the nominal cuts, without the printouts
+    quiet = true;
+
+    for (std::size_t config = 1; config < cutConfigs.size(); config++)
     {
-        cout << "Angle values for: " << boldOn << DatasetToString(dataset) << resetFormats << '\n';
-        cout << greenOn;
-        cout << boldOn << underlineOn << "ϕ:" << resetFormats << greenOn << " " << phi[dataset] << "\u00B0 ± "
-             << phiError[dataset] << "\u00B0.\n";
-        cout << boldOn << underlineOn << "θ:" << resetFormats << greenOn << " " << theta[dataset] << "\u00B0 ± "
-             << thetaError[dataset] << "\u00B0.\n"
-             << resetFormats;
-        cout << "--------------------------------------------\n";
+        activeConfig = config;
+
+        SubtractBackgrounds();
+        CalculateUnbiasing();
+        CalculateAngles();
+        OffsetTheta();
+
+        scanFile << config;
+
+        for (int dataset = Data; dataset < DatasetSize; dataset++)
+        {
+            scanFile << ' ' << phi[dataset] << ' ' << phiError[dataset] << ' ' << theta[dataset] << ' '
+                     << thetaError[dataset];
+        }
+
+        scanFile << "  " << cutConfigs[config].label << '\n';
+
+        cout << boldOn << cutConfigs[config].label << ": " << resetFormats << "ϕ = " << phi[Data] << "\u00B0 ± "
+             << phiError[Data] << "\u00B0, θ = " << theta[Data] << "\u00B0 ± " << thetaError[Data] << "\u00B0 (unbiased ϕ = "
+             << phi[DataUnbiased] << "\u00B0 ± " << phiError[DataUnbiased] << "\u00B0, θ = " << theta[DataUnbiased]
+             << "\u00B0 ± " << thetaError[DataUnbiased] << "\u00B0)\n";
     }
+
+    // Back to the nominal cuts for the usual output
+    quiet = false;
+    activeConfig = 0;
+
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Wrote cut scan: " << resetFormats << blueOn << boldOn << "BiPoCutScan.txt!\n"
+         << resetFormats;
 }
 
 void BiPo::FillOutputFile()
 {
+    ProfileScope scope("Write output");
+
     // Set up our output file
     TFile outputFile("BiPo.root", "recreate");
 
@@ -659,44 +2533,34 @@ void BiPo::FillOutputFile()
         }
     }
 
-    cout << boldOn << cyanOn << "Filled output file: " << resetFormats << blueOn << boldOn << "BiPo.root!\n" << resetFormats;
-    cout << "--------------------------------------------\n";
-
-    outputFile.Close();
-}
-
-int main(int argc, char* argv[])
-{
-    // Ignoring warnings
-    gErrorIgnoreLevel = kError;
+    // Cut flow of the nominal cuts, one bin per cut
+    CutFlow const& flow = counts[0].cutFlow;
+    TH1D alphaFlow("Cut Flow Alpha", "Alpha", AlphaCutSize, 0, AlphaCutSize);
 
-    // Using command line arguments for verbosity control
-    for (int i = 1; i < argc; i++)
+    for (int cut = 0; cut < AlphaCutSize; cut++)
     {
-        if (string(argv[i]) == "-D")
-            DETECTOR_VERBOSITY = 1;
-        else if (string(argv[i]) == "-N")
-            NCOUNT_VERBOSITY = 1;
+        alphaFlow.SetBinContent(cut + 1, flow.alpha[cut]);
+        alphaFlow.GetXaxis()->SetBinLabel(cut + 1, AlphaCutToString(cut).c_str());
     }
 
-    // Timing everything
-    Timer timer;
+    alphaFlow.Write();
+
+    for (int signalSet = Correlated; signalSet < TotalDifference; signalSet++)
+    {
+        string window = (signalSet == Correlated) ? "Prompt" : "Far";
+        TH1D betaFlow(("Cut Flow " + window).c_str(), window.c_str(), BetaCutSize, 0, BetaCutSize);
 
-    // Filling detector configuration
-    FillDetectorConfig();
+        for (int cut = 0; cut < BetaCutSize; cut++)
+        {
+            betaFlow.SetBinContent(cut + 1, flow.beta[signalSet][cut]);
+            betaFlow.GetXaxis()->SetBinLabel(cut + 1, BetaCutToString(cut).c_str());
+        }
 
-    // Setting up directionality class
-    BiPo directionality;
+        betaFlow.Write();
+    }
 
-    // Running analysis
-    directionality.ReadFileList();
-    directionality.SetUpHistograms();
-    directionality.SubtractBackgrounds();
-    directionality.CalculateUnbiasing();
-    directionality.CalculateAngles();
-    directionality.OffsetTheta();
-    directionality.PrintAngles();
-    directionality.FillOutputFile();
+    cout << boldOn << cyanOn << "Filled output file: " << resetFormats << blueOn << boldOn << "BiPo.root!\n" << resetFormats;
+    cout << "--------------------------------------------\n";
 
-    return 0;
-}
\ No newline at end of file
+    outputFile.Close();
+}
@@ -0,0 +1,400 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TDirectory.h"
+#include "TFile.h"
+#include "TROOT.h"
+#include "TTree.h"
+
+#include "Formatting.h"
+
+using std::cout, std::string, std::vector;
+
+// Writes synthetic runs in the BiPoTreePlugin format BiPo reads, so the whole pipeline can be run, timed and checked
+// without the real data. Each alpha comes with at most one correlated beta in its prompt window, displaced by a known
+// amount along the injected direction, plus uncorrelated betas at a constant rate in both windows.
+
+// Detector layout and units the analysis uses: mm and MeV, time in the same units as the BiPo cut windows
+constexpr int columns = 14, rows = 11;
+constexpr double segmentWidth = 145.7;
+constexpr double tauBiPo = 0.1643 / 0.69314718055994531;
+constexpr double promptLength = 1.0, farLength = 12.0;  // Plugin windows the betas are stored from
+
+struct Options
+{
+    int runs = 1740;
+    int events = 2000;  // Alphas per run
+    string directory = "Synthetic";
+    double phi = 30, theta = 60;  // Injected direction in degrees, theta from the z axis like the printed angles
+    double displacement = 20;  // Mean alpha - beta distance along the injected direction in mm
+    double smearing = 40;  // Position resolution of each axis in mm
+    double efficiency = 0.9;  // Chance an alpha has its correlated beta
+    double accidentalRate = 0.3;  // Uncorrelated betas per unit time in each window
+    int maxMultiplicity = 9;  // Betas kept per window, closest in time first
+    int threads = 1;
+    unsigned seed = 42;
+    bool singles = false;  // Also write the same clusters as a time ordered singles stream
+};
+
+// One window worth of betas in the plugin's branch layout
+struct Window
+{
+    vector<int> segment;
+    vector<double> time, z, psd, energy;
+    vector<int> cluster, clusterIonization;
+
+    void Clear()
+    {
+        segment.clear();
+        time.clear();
+        z.clear();
+        psd.clear();
+        energy.clear();
+        cluster.clear();
+        clusterIonization.clear();
+    }
+
+    void Branch(TTree& tree, string const& prefix)
+    {
+        tree.Branch((prefix + "seg").c_str(), &segment);
+        tree.Branch((prefix + "t").c_str(), &time);
+        tree.Branch((prefix + "z").c_str(), &z);
+        tree.Branch((prefix + "PSD").c_str(), &psd);
+        tree.Branch((prefix + "Etot").c_str(), &energy);
+        tree.Branch((prefix + "mult_clust").c_str(), &cluster);
+        tree.Branch((prefix + "mult_clust_ioni").c_str(), &clusterIonization);
+    }
+};
+
+struct Beta
+{
+    double deltaTime;  // Distance from the alpha in time, always positive
+    int segment;
+    double z, energy, psd;
+    bool clusterMatch;
+};
+
+// One cluster of the singles stream
+struct Single
+{
+    double time;
+    int segment;
+    double z, energy, psd;
+    int cluster, clusterIonization;
+};
+
+struct Position
+{
+    double x, y, z;
+
+    bool Inside() const
+    {
+        return x >= 0 && x < columns * segmentWidth && y >= 0 && y < rows * segmentWidth && std::abs(z) < 1000;
+    }
+
+    int Segment() const { return int(x / segmentWidth) + columns * int(y / segmentWidth); }
+};
+
+string RunName(int run)
+{
+    char name[64];
+    std::snprintf(name, sizeof(name), "Synthetic/series%03d/s%03d_f%05d_ts%d", run / 100, run / 100, run,
+                  1521215519 + 3600 * run);  // Hourly runs, named like the real ones
+
+    return name;
+}
+
+void GenerateRun(Options const& options, int run)
+{
+    std::mt19937_64 generator(options.seed + 7919ull * run);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::normal_distribution<double> normal(0, 1);
+    std::exponential_distribution<double> decay(1 / tauBiPo);
+    std::poisson_distribution<int> promptAccidentals(options.accidentalRate * promptLength);
+    std::poisson_distribution<int> farAccidentals(options.accidentalRate * farLength);
+
+    double const pi = std::acos(-1.0);
+    double directionX = std::sin(options.theta * pi / 180) * std::cos(options.phi * pi / 180);
+    double directionY = std::sin(options.theta * pi / 180) * std::sin(options.phi * pi / 180);
+    double directionZ = std::cos(options.theta * pi / 180);
+
+    string path = options.directory + "/" + RunName(run);
+    std::filesystem::create_directories(path);
+
+    TFile file((path + "/AD1_BiPo.root").c_str(), "recreate");
+    TDirectory* plugin = file.mkdir("BiPoTreePlugin");
+    plugin->cd();
+
+    TTree tree("BiPo", "BiPo");
+
+    Window prompt, far;
+    Int_t alphaSegment, multPrompt, multFar;
+    Double_t alphaEnergy, alphaTime, alphaZ, alphaPSD;
+
+    prompt.Branch(tree, "p");
+    far.Branch(tree, "f");
+    tree.Branch("aseg", &alphaSegment, "aseg/I");
+    tree.Branch("aE", &alphaEnergy, "aE/D");
+    tree.Branch("at", &alphaTime, "at/D");
+    tree.Branch("az", &alphaZ, "az/D");
+    tree.Branch("aPSD", &alphaPSD, "aPSD/D");
+    tree.Branch("mult_prompt", &multPrompt, "mult_prompt/I");
+    tree.Branch("mult_far", &multFar, "mult_far/I");
+
+    auto accidental = [&](double length)
+    {
+        Position position{uniform(generator) * columns * segmentWidth, uniform(generator) * rows * segmentWidth,
+                          (2 * uniform(generator) - 1) * 1000};
+
+        Beta beta;
+        beta.deltaTime = uniform(generator) * length;
+        beta.segment = position.Segment();
+        beta.z = position.z;
+        beta.energy = -std::log(1 - uniform(generator));
+        beta.psd = 0.13 + 0.04 * normal(generator);
+        beta.clusterMatch = uniform(generator) < 0.97;
+
+        return beta;
+    };
+
+    // Sorted by time from the alpha and cut at the maximum multiplicity, the way the plugin stores its windows
+    auto store = [&](vector<Beta>& betas, Window& window, double sign)
+    {
+        std::sort(betas.begin(), betas.end(), [](Beta const& a, Beta const& b) { return a.deltaTime < b.deltaTime; });
+        betas.resize(std::min<std::size_t>(betas.size(), options.maxMultiplicity));
+
+        window.Clear();
+
+        for (Beta const& beta : betas)
+        {
+            window.segment.push_back(beta.segment);
+            window.time.push_back(alphaTime + sign * beta.deltaTime);
+            window.z.push_back(beta.z);
+            window.psd.push_back(beta.psd);
+            window.energy.push_back(beta.energy);
+            window.cluster.push_back(1);
+            window.clusterIonization.push_back(beta.clusterMatch ? 1 : 2);
+        }
+
+        return (int)betas.size();
+    };
+
+    alphaTime = 0;
+    vector<Beta> promptBetas, farBetas;
+    vector<Single> singles;
+
+    // The alpha and the betas the plugin stored around it, at their own times
+    auto keepSingles = [&]()
+    {
+        singles.push_back(Single{alphaTime, alphaSegment, alphaZ, alphaEnergy, alphaPSD, 1, 1});
+
+        for (Beta const& beta : promptBetas)
+        {
+            singles.push_back(Single{alphaTime - beta.deltaTime, beta.segment, beta.z, beta.energy, beta.psd, 1,
+                                     beta.clusterMatch ? 1 : 2});
+        }
+
+        for (Beta const& beta : farBetas)
+        {
+            singles.push_back(Single{alphaTime + beta.deltaTime, beta.segment, beta.z, beta.energy, beta.psd, 1,
+                                     beta.clusterMatch ? 1 : 2});
+        }
+    };
+
+    for (int event = 0; event < options.events; event++)
+    {
+        // Correlated pair, the alpha displaced from the beta along the injected direction
+        Position beta, alpha;
+
+        do
+        {
+            beta = {uniform(generator) * columns * segmentWidth, uniform(generator) * rows * segmentWidth,
+                    (2 * uniform(generator) - 1) * 950};
+            alpha = {beta.x + options.displacement * directionX + options.smearing * normal(generator),
+                     beta.y + options.displacement * directionY + options.smearing * normal(generator),
+                     beta.z + options.displacement * directionZ + options.smearing * normal(generator)};
+        } while (!alpha.Inside());
+
+        alphaTime += 1000 * -std::log(1 - uniform(generator));
+        alphaSegment = alpha.Segment();
+        alphaZ = alpha.z;
+        alphaEnergy = 0.86 + 0.04 * normal(generator);
+        alphaPSD = 0.25 + 0.03 * normal(generator);
+
+        promptBetas.clear();
+        farBetas.clear();
+
+        double deltaTime = decay(generator);
+
+        if (uniform(generator) < options.efficiency && deltaTime < promptLength)
+        {
+            promptBetas.push_back(Beta{deltaTime, beta.Segment(), beta.z, 0.05 + 3.15 * uniform(generator),
+                                       0.12 + 0.03 * normal(generator), uniform(generator) < 0.97});
+        }
+
+        for (int n = promptAccidentals(generator); n > 0; n--)
+        {
+            promptBetas.push_back(accidental(promptLength));
+        }
+
+        for (int n = farAccidentals(generator); n > 0; n--)
+        {
+            farBetas.push_back(accidental(farLength));
+        }
+
+        // Prompt betas come before the alpha, far betas after it
+        multPrompt = store(promptBetas, prompt, -1);
+        multFar = store(farBetas, far, 1);
+
+        tree.Fill();
+
+        if (options.singles)
+            keepSingles();
+    }
+
+    tree.Write();
+    file.Close();
+
+    if (!options.singles)
+        return;
+
+    // Windows of neighbouring alphas can overlap, so the stream is sorted once at the end
+    std::stable_sort(singles.begin(), singles.end(), [](Single const& a, Single const& b) { return a.time < b.time; });
+
+    TFile singlesFile((path + "/AD1_Singles.root").c_str(), "recreate");
+    TTree singlesTree("Singles", "Singles");
+    Single single;
+
+    singlesTree.Branch("t", &single.time, "t/D");
+    singlesTree.Branch("seg", &single.segment, "seg/I");
+    singlesTree.Branch("z", &single.z, "z/D");
+    singlesTree.Branch("E", &single.energy, "E/D");
+    singlesTree.Branch("PSD", &single.psd, "PSD/D");
+    singlesTree.Branch("mult_clust", &single.cluster, "mult_clust/I");
+    singlesTree.Branch("mult_clust_ioni", &single.clusterIonization, "mult_clust_ioni/I");
+
+    for (Single const& kept : singles)
+    {
+        single = kept;
+        singlesTree.Fill();
+    }
+
+    singlesTree.Write();
+    singlesFile.Close();
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string flag = argv[i];
+
+        if (flag == "--singles")
+        {
+            options.singles = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+            break;
+
+        if (flag == "-r")
+            options.runs = std::stoi(argv[++i]);
+        else if (flag == "-e")
+            options.events = std::stoi(argv[++i]);
+        else if (flag == "-o")
+            options.directory = argv[++i];
+        else if (flag == "--phi")
+            options.phi = std::stod(argv[++i]);
+        else if (flag == "--theta")
+            options.theta = std::stod(argv[++i]);
+        else if (flag == "--displacement")
+            options.displacement = std::stod(argv[++i]);
+        else if (flag == "--smearing")
+            options.smearing = std::stod(argv[++i]);
+        else if (flag == "--efficiency")
+            options.efficiency = std::stod(argv[++i]);
+        else if (flag == "--accidentals")
+            options.accidentalRate = std::stod(argv[++i]);
+        else if (flag == "--multiplicity")
+            options.maxMultiplicity = std::stoi(argv[++i]);
+        else if (flag == "-T")
+            options.threads = std::stoi(argv[++i]);
+        else if (flag == "--seed")
+            options.seed = std::stoul(argv[++i]);
+    }
+
+    if (options.threads > 1)
+        ROOT::EnableThreadSafety();
+
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Generating " << options.runs << " runs of " << options.events << " alphas.\n"
+         << resetFormats;
+    cout << "--------------------------------------------\n";
+
+    // Runs are independent, each seeded from its number, so the output doesn't depend on the thread count
+    std::atomic<int> next = 0, done = 0;
+    vector<std::thread> threads;
+
+    for (int thread = 0; thread < std::max(options.threads, 1); thread++)
+    {
+        threads.emplace_back(
+            [&]()
+            {
+                for (int run = next++; run < options.runs; run = next++)
+                {
+                    GenerateRun(options, run);
+                    done++;
+                }
+            });
+    }
+
+    while (done < options.runs)
+    {
+        cout << "Writing run: " << done << "/" << options.runs << '\r';
+        cout.flush();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    // File list and a config pointing BiPo at it
+    std::ofstream list(options.directory + "/SyntheticList.txt");
+
+    for (int run = 0; run < options.runs; run++)
+    {
+        list << RunName(run) << '\n';
+    }
+
+    std::ofstream config(options.directory + "/Synthetic.cfg");
+    config << "# Written by BiPoGenerator\n";
+    config << "dataPath " << options.directory << "/SyntheticList.txt\n";
+    config << "dataFileName " << options.directory << "/%s/AD1_BiPo.root\n";
+
+    cout << "--------------------------------------------\n";
+    cout << boldOn << "Injected direction: " << resetFormats << "ϕ = " << options.phi << "°, θ = " << options.theta
+         << "°\n";
+    cout << boldOn << "Run with: " << resetFormats << "./BiPo -F " << options.directory << "/Synthetic.cfg\n";
+
+    if (options.singles)
+        cout << boldOn << "Or from singles: " << resetFormats << "./BiPo -F " << options.directory
+             << "/Synthetic.cfg --singles " << options.directory << "/%s/AD1_Singles.root\n";
+    cout << "--------------------------------------------\n";
+
+    return 0;
+}
@@ -0,0 +1,478 @@
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "BetaSelection.h"
+#include "CoincidenceBuilder.h"
+#include "CutConfig.h"
+#include "DetectorConfig.h"
+#include "FixedHistogram.h"
+#include "Formatting.h"
+#include "ToyMC.h"
+
+using std::cout, std::string, std::vector;
+
+// Checks of the header-only pieces that don't need ROOT or any data. Exits with 1 if any check failed.
+
+int failures = 0;
+
+void Check(string const& name, bool passed)
+{
+    if (!passed)
+        failures++;
+
+    cout << (passed ? greenOn : redOn) << (passed ? "passed: " : "FAILED: ") << resetFormats << name << '\n';
+}
+
+void BinIndexTests()
+{
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Bin edges.\n" << resetFormats;
+
+    vector<float> edges = ReadBinEdges("0,1.5,2.5,4", 0, 4);
+
+    Check("Low edge is in the first bin", BinIndex(edges, 0) == 0);
+    Check("Inner edge starts the next bin", BinIndex(edges, 1.5) == 1);
+    Check("Value inside the last bin", BinIndex(edges, 3) == 2);
+    Check("Value on the top edge is in the last bin", BinIndex(edges, 4) == 2);
+    Check("Below the low edge is outside", BinIndex(edges, -0.1) == -1);
+    Check("Above the top edge is outside", BinIndex(edges, 4.1) == -1);
+
+    // Equal bins end exactly on the upper cut limit, so a beta right on the cut is still counted
+    float low = 0.95, high = 3.7;
+    vector<float> equal = ReadBinEdges("7", low, high);
+
+    Check("Equal bins end on the upper limit", equal.size() == 8 && equal.back() == high);
+    Check("Beta on the upper energy cut is in the last bin", BinIndex(equal, high) == 6);
+    Check("No bins without edges", BinIndex({}, 1) == -1);
+
+    // Bad specs are refused instead of read as far as they go
+    Check("Bin count with trailing characters", ReadBinEdges("8x", low, high).empty());
+    Check("Zero bins", ReadBinEdges("0", low, high).empty());
+    Check("Edge that isn't a number", ReadBinEdges("0,1,abc,4", low, high).empty());
+    Check("Edge with trailing characters", ReadBinEdges("0,1.5cm,4", low, high).empty());
+    Check("Empty edge", ReadBinEdges("0,,4", low, high).empty());
+    Check("Edges that don't increase", ReadBinEdges("0,2,2,4", low, high).empty());
+    Check("Single edge", ReadBinEdges("1,", low, high).empty());
+    Check("Spaces around edges", ReadBinEdges("0, 1.5 ,4", low, high) == vector<float>{0, 1.5, 4});
+}
+
+void DetectorPeriodTests()
+{
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Detector periods.\n" << resetFormats;
+
+    // Segment 15 dies at the second period and 16 at the third
+    constexpr std::array periods{DetectorPeriod{0, SegmentTable{std::array{0}}},
+                                 DetectorPeriod{1000, SegmentTable{std::array{0, 15}}},
+                                 DetectorPeriod{2000, SegmentTable{std::array{0, 15, 16}}}};
+
+    Check("Run without a ts is in the first period", DetectorPeriodAt(periods, 0) == 0);
+    Check("Run before the second start is in the first period", DetectorPeriodAt(periods, 999) == 0);
+    Check("Run on the second start is in the second period", DetectorPeriodAt(periods, 1000) == 1);
+    Check("Run between starts stays in its period", DetectorPeriodAt(periods, 1999) == 1);
+    Check("Run after the last start is in the last period", DetectorPeriodAt(periods, 5000) == 2);
+    Check("Segment dies with its period", periods[0].segments[15].live && !periods[1].segments[15].live);
+    Check("Neighbours follow the period",
+          periods[1].segments[16].Neighbor(NeighborDown) && !periods[1].segments[16].Neighbor(NeighborLeft));
+}
+
+template <typename Histogram>
+bool SameHistograms(Histogram const& one, Histogram const& other)
+{
+    bool same = one.Entries() == other.Entries() && one.Stats() == other.Stats();
+
+    for (int bin = 0; bin < Histogram::bins + 2; bin++)
+    {
+        same = same && one.BinContent(bin) == other.BinContent(bin) && one.BinSumw2(bin) == other.BinSumw2(bin);
+    }
+
+    return same;
+}
+
+void FixedHistogramTests()
+{
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Fixed histograms.\n" << resetFormats;
+
+    // Accidental fills with the float n2f weight, some of them outside the axis
+    double n2f = float(1 / 12.0);
+    std::mt19937 generator(11);
+    std::normal_distribution<float> spread(0, 90);
+    std::uniform_int_distribution<int> split(1, 5000);
+
+    vector<float> values(200000);
+
+    for (float& value : values)
+    {
+        value = spread(generator);
+    }
+
+    FixedHistogram<ZAxis> serial, merged, rest;
+
+    for (float value : values)
+    {
+        serial.Fill(value, n2f);
+    }
+
+    // Same values split into partials of random sizes, like runs spread over workers or shards
+    vector<FixedHistogram<ZAxis>> partials;
+
+    for (std::size_t first = 0; first < values.size();)
+    {
+        std::size_t last = std::min(values.size(), first + split(generator));
+        partials.emplace_back();
+
+        for (std::size_t i = first; i < last; i++)
+        {
+            partials.back().Fill(values[i], n2f);
+        }
+
+        first = last;
+    }
+
+    for (auto const& partial : partials)
+    {
+        merged.Add(partial);
+    }
+
+    Check("Merged partials match the serial fill", SameHistograms(serial, merged));
+
+    // Jackknife takes one partial back out of the total
+    merged.Add(partials[0], -1);
+
+    for (std::size_t i = 1; i < partials.size(); i++)
+    {
+        rest.Add(partials[i]);
+    }
+
+    Check("Taking a partial back out matches never adding it", SameHistograms(merged, rest));
+}
+
+// Columns of one batch, with the BetaBatch pointing into them
+struct BetaColumns
+{
+    vector<std::uint8_t> segment;
+    vector<float> energy, psd, z, deltaTime, alphaZ;
+    vector<std::int32_t> alphaSegment;
+
+    BetaBatch Batch() const
+    {
+        return {segment.size(), segment.data(),   energy.data(),       psd.data(),
+                z.data(),       deltaTime.data(), alphaSegment.data(), alphaZ.data()};
+    }
+};
+
+void BetaSelectionTests()
+{
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Beta selection.\n" << resetFormats;
+
+    BetaWindowCuts cuts{0.5, 3, 0.1, 0.3, 1000, 250, 400, 1, 20, {}};
+
+    for (int segment = 0; segment < (int)cuts.rejectSegment.size(); segment++)
+    {
+        cuts.rejectSegment[segment] = (segment % 14 == 0 || segment >= 154);
+    }
+
+    // Values on the cut edges, NaNs and rejected alphas mixed in with ordinary ones
+    float nan = std::numeric_limits<float>::quiet_NaN();
+    std::mt19937 generator(5);
+    std::uniform_real_distribution<float> uniform(-1, 1);
+    std::uniform_int_distribution<int> segment(0, 160), pick(0, 15);
+
+    auto edgy = [&](float ordinary, float low, float high)
+    {
+        switch (pick(generator))
+        {
+            case 0:
+                return low;
+            case 1:
+                return high;
+            case 2:
+                return nan;
+            default:
+                return ordinary;
+        }
+    };
+
+    bool same = true, sameCounts = true;
+    std::size_t selectedTotal = 0;
+
+    for (int batch = 0; batch < 3000; batch++)
+    {
+        // Sizes from empty to a few steps of eight plus a remainder
+        std::size_t size = batch % 45;
+        BetaColumns columns;
+
+        for (std::size_t i = 0; i < size; i++)
+        {
+            columns.segment.push_back(segment(generator));
+            columns.energy.push_back(edgy(1.75f + 1.5f * uniform(generator), cuts.lowEnergy, cuts.highEnergy));
+            columns.psd.push_back(edgy(0.2f + 0.12f * uniform(generator), cuts.lowPSD, cuts.highPSD));
+            columns.z.push_back(edgy(900 * uniform(generator), -cuts.maxZ, cuts.maxZ));
+            columns.deltaTime.push_back(edgy(10.5f + 10 * uniform(generator), cuts.timeStart, cuts.timeEnd));
+            columns.alphaZ.push_back(edgy(columns.z.back() + 300 * uniform(generator), nan, columns.z.back() + 250));
+            columns.alphaSegment.push_back(pick(generator) == 0 ? -1 : segment(generator) % 154);
+        }
+
+        BetaBatch betas = columns.Batch();
+        vector<std::uint32_t> scalar(size), avx2(size);
+        std::array<std::size_t, BetaSelection::stages> scalarRejected{}, avx2Rejected{};
+
+        std::size_t scalarCount = BetaSelection::SelectScalar(betas, cuts, scalar.data(), scalarRejected.data());
+        selectedTotal += scalarCount;
+
+        if (!__builtin_cpu_supports("avx2"))
+            continue;
+
+        std::size_t avx2Count = BetaSelection::SelectAVX2(betas, cuts, avx2.data(), avx2Rejected.data());
+        scalar.resize(scalarCount);
+        avx2.resize(avx2Count);
+
+        same = same && scalar == avx2;
+        sameCounts = sameCounts && scalarRejected == avx2Rejected;
+    }
+
+    Check("Batches select some betas", selectedTotal > 0);
+
+    if (!__builtin_cpu_supports("avx2"))
+    {
+        cout << "No AVX2 on this CPU, the AVX2 selection wasn't checked.\n";
+        return;
+    }
+
+    Check("AVX2 and scalar selections pick the same betas", same);
+    Check("AVX2 and scalar selections count the same rejections", sameCounts);
+}
+
+// Clusters numbered by their segment so the windows can be compared by identity
+vector<int> Segments(vector<SingleCluster> const& clusters)
+{
+    vector<int> segments;
+
+    for (SingleCluster const& cluster : clusters)
+    {
+        segments.push_back(cluster.segment);
+    }
+
+    return segments;
+}
+
+vector<Coincidence> Build(CoincidenceWindows const& windows, vector<SingleCluster> const& stream)
+{
+    CoincidenceBuilder builder(windows);
+    vector<Coincidence> built;
+    auto emit = [&](Coincidence const& coincidence) { built.push_back(coincidence); };
+
+    for (SingleCluster const& cluster : stream)
+    {
+        builder.Add(cluster, emit);
+    }
+
+    builder.Finish(emit);
+
+    return built;
+}
+
+// The windows straight from their definition, looking from every alpha until the stream leaves its window
+vector<Coincidence> BuildByHand(CoincidenceWindows const& windows, vector<SingleCluster> const& stream)
+{
+    vector<Coincidence> built;
+
+    for (std::size_t i = 0; i < stream.size(); i++)
+    {
+        SingleCluster const& alpha = stream[i];
+
+        if (alpha.energy < windows.lowAlphaEnergy || alpha.energy > windows.highAlphaEnergy
+            || alpha.psd < windows.lowAlphaPSD || alpha.psd > windows.highAlphaPSD)
+            continue;
+
+        Coincidence coincidence;
+        coincidence.alpha = alpha;
+
+        for (std::size_t j = i; j-- > 0;)
+        {
+            double deltaTime = alpha.time - stream[j].time;
+
+            if (deltaTime >= windows.promptLength)
+                break;
+
+            if (deltaTime > 0)
+                coincidence.prompt.push_back(stream[j]);
+        }
+
+        for (std::size_t j = i + 1; j < stream.size(); j++)
+        {
+            double deltaTime = stream[j].time - alpha.time;
+
+            if (deltaTime >= windows.farEnd)
+                break;
+
+            if (deltaTime > windows.farStart)
+                coincidence.far.push_back(stream[j]);
+        }
+
+        built.push_back(coincidence);
+    }
+
+    return built;
+}
+
+bool SameCoincidences(vector<Coincidence> const& built, vector<Coincidence> const& expected)
+{
+    bool same = built.size() == expected.size();
+
+    for (std::size_t i = 0; same && i < built.size(); i++)
+    {
+        same = built[i].alpha.segment == expected[i].alpha.segment
+               && Segments(built[i].prompt) == Segments(expected[i].prompt)
+               && Segments(built[i].far) == Segments(expected[i].far);
+    }
+
+    return same;
+}
+
+void CoincidenceBuilderTests()
+{
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Coincidence builder.\n" << resetFormats;
+
+    // Times are multiples of 1/8 so clusters land exactly on the window edges
+    CoincidenceWindows windows{1, 0.5, 2, 1, 2, 0, 1};
+    float alpha = 1.5, beta = 0.5;
+
+    // Prompt window is (0, 1) before the alpha, far window (0.5, 2) after it
+    vector<SingleCluster> edges{{9, 0, 0, beta, 0.5, 1, 1},     {9.25, 1, 0, beta, 0.5, 1, 1},
+                                {9.5, 2, 0, beta, 0.5, 1, 1},   {10, 3, 0, alpha, 0.5, 1, 1},
+                                {10, 4, 0, beta, 0.5, 1, 1},    {10.5, 5, 0, beta, 0.5, 1, 1},
+                                {11.875, 6, 0, beta, 0.5, 1, 1}, {12, 7, 0, beta, 0.5, 1, 1}};
+
+    CoincidenceBuilder builder(windows);
+    vector<Coincidence> built;
+    auto emit = [&](Coincidence const& coincidence) { built.push_back(coincidence); };
+
+    for (SingleCluster const& cluster : edges)
+    {
+        builder.Add(cluster, emit);
+    }
+
+    Check("Cluster on the far window end closes it", built.size() == 1);
+    builder.Finish(emit);
+    Check("Closed alpha isn't emitted again", built.size() == 1);
+
+    if (built.size() == 1)
+    {
+        Check("Prompt window excludes its start and the alpha's own time, newest first",
+              Segments(built[0].prompt) == vector<int>{2, 1});
+        Check("Far window excludes both of its edges", Segments(built[0].far) == vector<int>{6});
+    }
+
+    // Alphas still open at the end of the run keep the far window they have so far
+    vector<SingleCluster> open{{0, 0, 0, alpha, 0.5, 1, 1}, {1, 1, 0, beta, 0.5, 1, 1}};
+    built = Build(windows, open);
+    Check("Finish emits the open alphas", built.size() == 1 && Segments(built[0].far) == vector<int>{1});
+
+    // Bursts of many clusters at the same time and dense stretches, so both ring buffers grow past their first 16 slots
+    // and wrap around many times
+    std::mt19937 generator(7);
+    std::uniform_int_distribution<int> gap(0, 2), burst(1, 40);
+    std::uniform_real_distribution<float> energy(0.5, 2.5);
+    vector<SingleCluster> stream;
+    double time = 0;
+
+    while (stream.size() < 100000)
+    {
+        time += gap(generator) / 8.0;
+
+        for (int cluster = burst(generator) == 1 ? 40 : 1; cluster > 0; cluster--)
+        {
+            stream.push_back({time, (int)stream.size(), 0, energy(generator), 0.5, 1, 1});
+        }
+    }
+
+    vector<Coincidence> expected = BuildByHand(windows, stream);
+    std::size_t widest = 0;
+
+    for (Coincidence const& coincidence : expected)
+    {
+        widest = std::max(widest, coincidence.prompt.size());
+    }
+
+    Check("Random stream fills more than 16 slots", widest > 16);
+    Check("Random stream matches building by hand", SameCoincidences(Build(windows, stream), expected));
+}
+
+void ToyTests()
+{
+    cout << "--------------------------------------------\n";
+    cout << boldOn << cyanOn << "Toy random lanes and Poisson draws.\n" << resetFormats;
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        LaneRandom scalar(11), avx2(11);
+        bool same = true;
+
+        for (int refill = 0; refill < 1000; refill++)
+        {
+            scalar.RefillScalar();
+            avx2.RefillAVX2();
+
+            for (int i = 0; i < LaneRandom::block; i++)
+            {
+                same = same && scalar.Uniform() == avx2.Uniform();
+            }
+        }
+
+        Check("AVX2 and scalar lanes give the same uniforms", same);
+    }
+    else
+        cout << "No AVX2 on this machine, not comparing the lanes.\n";
+
+    // Knuth below a mean of 10 and PTRS from 10 on, so both sides of the switch and one well inside each
+    LaneRandom random(5);
+    int const draws = 1000000;
+
+    for (double mean : {3.0, 9.9, 10.0, 10.1, 50.0})
+    {
+        PoissonSampler sampler(mean);
+        double sum = 0, sum2 = 0;
+
+        for (int draw = 0; draw < draws; draw++)
+        {
+            double k = sampler(random);
+            sum += k;
+            sum2 += k * k;
+        }
+
+        double average = sum / draws;
+        double variance = sum2 / draws - average * average;
+        std::ostringstream name;
+        name << "Poisson mean " << mean;
+
+        // Five standard errors, the variance of a sample variance of a Poisson is (mean + 2 mean^2) / draws
+        Check(name.str() + " has that mean",
+              std::abs(average - mean) < 5 * std::sqrt(mean / draws));
+        Check(name.str() + " has that variance",
+              std::abs(variance - mean) < 5 * std::sqrt((mean + 2 * mean * mean) / draws));
+    }
+}
+
+int main()
+{
+    BinIndexTests();
+    DetectorPeriodTests();
+    FixedHistogramTests();
+    BetaSelectionTests();
+    CoincidenceBuilderTests();
+    ToyTests();
+
+    cout << "--------------------------------------------\n";
+    cout << boldOn << (failures == 0 ? greenOn : redOn) << failures << " failed checks.\n" << resetFormats;
+
+    return failures == 0 ? 0 : 1;
+}
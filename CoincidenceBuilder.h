@@ -0,0 +1,173 @@
+#ifndef COINCIDENCEBUILDER_H
+#define COINCIDENCEBUILDER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Builds alpha - beta coincidences from a time ordered stream of single clusters, in place of the windows the P2x BiPo
+// plugin stores around each alpha. Every cluster inside the alpha selection opens a coincidence: its prompt window holds
+// the clusters up to promptLength before it, its far window the clusters between farStart and farEnd after it, both
+// closest in time first like the plugin's. Any cluster can be a beta, the beta cuts are left to FillBeta.
+//
+// Clusters from the last promptLength are kept in one ring buffer and alphas still waiting for their far window to
+// close in another, so memory only depends on the rates and window lengths, not on the run length, and every cluster
+// is visited a bounded number of times on average.
+
+struct SingleCluster
+{
+    double time;
+    int segment;
+    float z;
+    float energy;
+    float psd;
+    int cluster;  // Cluster multiplicity
+    int clusterIonization;  // Ionization cluster multiplicity
+};
+
+struct Coincidence
+{
+    SingleCluster alpha;
+    std::vector<SingleCluster> prompt, far;
+};
+
+// Windows and alpha selection, in the units of the cluster times and energies
+struct CoincidenceWindows
+{
+    double promptLength;
+    double farStart, farEnd;
+    float lowAlphaEnergy, highAlphaEnergy;
+    float lowAlphaPSD, highAlphaPSD;
+};
+
+// FIFO over a vector that only grows when it's full. Slots are reused in place, so the vectors inside them keep their
+// capacity from one alpha to the next
+template <typename T>
+class RingBuffer
+{
+  public:
+    std::size_t Size() const { return size; }
+    bool Empty() const { return size == 0; }
+
+    // Position 0 is the oldest element
+    T& operator[](std::size_t position) { return slots[(head + position) % slots.size()]; }
+    T& Front() { return slots[head]; }
+    T& Back() { return (*this)[size - 1]; }
+
+    // Returns the new last slot, which still holds whatever was there before
+    T& PushBack()
+    {
+        if (size == slots.size())
+            Grow();
+
+        size++;
+
+        return Back();
+    }
+
+    void PopFront()
+    {
+        head = (head + 1) % slots.size();
+        size--;
+    }
+
+    void Clear() { head = size = 0; }
+
+  private:
+    std::vector<T> slots;
+    std::size_t head = 0, size = 0;
+
+    void Grow()
+    {
+        std::vector<T> grown(std::max<std::size_t>(16, 2 * slots.size()));
+
+        for (std::size_t position = 0; position < size; position++)
+        {
+            grown[position] = std::move((*this)[position]);
+        }
+
+        slots = std::move(grown);
+        head = 0;
+    }
+};
+
+class CoincidenceBuilder
+{
+  public:
+    explicit CoincidenceBuilder(CoincidenceWindows const& windows) : windows(windows) {}
+
+    // Adds the next cluster, clusters have to come in time order. emit(Coincidence const&) is called for every alpha
+    // whose far window this cluster closed
+    template <typename Emit>
+    void Add(SingleCluster const& cluster, Emit&& emit)
+    {
+        // Alphas whose far window ended before this cluster are complete
+        while (!pending.Empty() && cluster.time - pending.Front().alpha.time >= windows.farEnd)
+        {
+            emit(pending.Front());
+            pending.PopFront();
+        }
+
+        // Pending alphas are in time order, so the cluster lands in their far windows closest in time first
+        for (std::size_t position = 0; position < pending.Size(); position++)
+        {
+            Coincidence& open = pending[position];
+            double deltaTime = cluster.time - open.alpha.time;
+
+            if (deltaTime > windows.farStart)
+                open.far.push_back(cluster);
+        }
+
+        // Clusters that dropped out of every prompt window
+        while (!recent.Empty() && cluster.time - recent.Front().time >= windows.promptLength)
+        {
+            recent.PopFront();
+        }
+
+        if (IsAlpha(cluster))
+        {
+            Coincidence& opened = pending.PushBack();
+            opened.alpha = cluster;
+            opened.prompt.clear();
+            opened.far.clear();
+
+            // Newest first, clusters at the same time as the alpha aren't before it
+            for (std::size_t position = recent.Size(); position > 0; position--)
+            {
+                SingleCluster const& earlier = recent[position - 1];
+
+                if (cluster.time - earlier.time > 0)
+                    opened.prompt.push_back(earlier);
+            }
+        }
+
+        recent.PushBack() = cluster;
+    }
+
+    // End of the run, the alphas still open get the far window they have so far
+    template <typename Emit>
+    void Finish(Emit&& emit)
+    {
+        while (!pending.Empty())
+        {
+            emit(pending.Front());
+            pending.PopFront();
+        }
+
+        recent.Clear();
+    }
+
+  private:
+    CoincidenceWindows windows;
+    RingBuffer<SingleCluster> recent;
+    RingBuffer<Coincidence> pending;
+
+    bool IsAlpha(SingleCluster const& cluster) const
+    {
+        return cluster.energy >= windows.lowAlphaEnergy && cluster.energy <= windows.highAlphaEnergy
+               && cluster.psd >= windows.lowAlphaPSD && cluster.psd <= windows.highAlphaPSD;
+    }
+};
+
+#endif
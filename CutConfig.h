@@ -0,0 +1,331 @@
+#ifndef CUTCONFIG_H
+#define CUTCONFIG_H
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// One set of alpha and beta cut values. BiPo fills one set of counts per configuration in the same pass.
+struct CutConfig
+{
+    float lowAlphaEnergy, highAlphaEnergy;  // Alpha energy cut
+    float lowAlphaPSD, highAlphaPSD;  // Alpha PSD cut
+    float lowBetaEnergy, highBetaEnergy;  // Beta energy cut
+    float lowBetaPSD, highBetaPSD;  // Beta PSD cut
+    float maxDisplacement;  // Alpha - beta distance cut in mm
+    float timeStart, timeEnd;  // Time window for BiPo
+    float accTimeStart, accTimeEnd;  // Accidental time window
+
+    std::string label;  // Values that differ from the nominal configuration
+
+    // Accidental window stays 1 / n2f times as long as the BiPo window so the n2f weight still applies
+    void UpdateAccidentalWindow(float n2f) { accTimeEnd = accTimeStart + (1 / n2f) * (timeEnd - timeStart); }
+};
+
+// Everything that used to need a recompile: the nominal cuts, the BiPo lifetime the time windows are built from, the
+// accidental weight and where the data lives. The defaults are the values the analysis has always used.
+struct AnalysisConfig
+{
+    float tauBiPo = 0.1643 / std::log(2);  // BiPo lifetime
+    float n2f = 1 / 12.0;  // Accidental scaling weight
+
+    CutConfig cuts{0.72,
+                   1.0,
+                   0.17,
+                   0.34,
+                   0,
+                   4.0,
+                   0.05,
+                   0.22,
+                   550,
+                   0.01,
+                   3 * tauBiPo,
+                   10 * tauBiPo,
+                   10 * tauBiPo + 12 * (3 * tauBiPo - 0.01f),
+                   "nominal"};
+
+    std::string dataPath = "2019XList_RxOff.txt";  // Reactor off dataset
+    std::string dataFileName = "/home/shay/Documents/PROSPECTData/BiPo_Data/%s/AD1_BiPo.root";
+};
+
+// Cut values that can be scanned, by the name used in grid files
+inline std::map<std::string, float CutConfig::*> const& ScanParameters()
+{
+    static std::map<std::string, float CutConfig::*> const parameters
+        = {{"lowAlphaEnergy", &CutConfig::lowAlphaEnergy},
+           {"highAlphaEnergy", &CutConfig::highAlphaEnergy},
+           {"lowAlphaPSD", &CutConfig::lowAlphaPSD},
+           {"highAlphaPSD", &CutConfig::highAlphaPSD},
+           {"lowBetaEnergy", &CutConfig::lowBetaEnergy},
+           {"highBetaEnergy", &CutConfig::highBetaEnergy},
+           {"lowBetaPSD", &CutConfig::lowBetaPSD},
+           {"highBetaPSD", &CutConfig::highBetaPSD},
+           {"maxDisplacement", &CutConfig::maxDisplacement},
+           {"timeStart", &CutConfig::timeStart},
+           {"timeEnd", &CutConfig::timeEnd}};
+
+    return parameters;
+}
+
+// Reads a configuration file of "name value" lines, # starts a comment:
+//
+//   tauBiPo 0.237
+//   lowAlphaPSD 0.18
+//   dataPath 2019XList_RxOn.txt
+//
+// Anything not given keeps its default. Time windows not given are rebuilt from tauBiPo like the defaults are, and the
+// accidental window end from n2f. Returns false and leaves config untouched if the file can't be used.
+inline bool ReadAnalysisConfig(std::string const& path, AnalysisConfig& config)
+{
+    std::ifstream file(path);
+
+    if (!file.is_open())
+    {
+        std::cout << "Config file not found: " << path << '\n';
+        return false;
+    }
+
+    AnalysisConfig read = config;
+    std::map<std::string, float> values;
+    std::string line;
+    int lineNumber = 0;
+
+    while (std::getline(file, line))
+    {
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream stream(line);
+        std::string name, value, extra;
+
+        if (!(stream >> name))
+            continue;
+
+        if (!(stream >> value) || (stream >> extra))
+        {
+            std::cout << "Expected one value for " << name << " on line " << lineNumber << " of " << path << '\n';
+            return false;
+        }
+
+        if (name == "dataPath")
+        {
+            read.dataPath = value;
+            continue;
+        }
+
+        if (name == "dataFileName")
+        {
+            read.dataFileName = value;
+            continue;
+        }
+
+        if (name != "tauBiPo" && name != "n2f" && name != "accTimeStart" && name != "accTimeEnd"
+            && ScanParameters().count(name) == 0)
+        {
+            std::cout << "Unknown setting " << name << " on line " << lineNumber << " of " << path << '\n';
+            return false;
+        }
+
+        std::istringstream number(value);
+
+        if (!(number >> values[name]) || !number.eof())
+        {
+            std::cout << "Bad value for " << name << " on line " << lineNumber << " of " << path << '\n';
+            return false;
+        }
+    }
+
+    // The lifetime goes first since the default windows are multiples of it
+    if (values.count("tauBiPo"))
+    {
+        read.tauBiPo = values["tauBiPo"];
+        read.cuts.timeEnd = 3 * read.tauBiPo;
+        read.cuts.accTimeStart = 10 * read.tauBiPo;
+    }
+
+    if (values.count("n2f"))
+        read.n2f = values["n2f"];
+
+    for (auto const& [name, member] : ScanParameters())
+    {
+        if (values.count(name))
+            read.cuts.*member = values[name];
+    }
+
+    if (values.count("accTimeStart"))
+        read.cuts.accTimeStart = values["accTimeStart"];
+
+    if (values.count("accTimeEnd"))
+        read.cuts.accTimeEnd = values["accTimeEnd"];
+    else if (values.count("tauBiPo") || values.count("n2f") || values.count("timeStart") || values.count("timeEnd")
+             || values.count("accTimeStart"))
+        read.cuts.UpdateAccidentalWindow(read.n2f);
+
+    if (!(read.n2f > 0) || !(read.cuts.timeEnd > read.cuts.timeStart) || !(read.cuts.accTimeEnd > read.cuts.accTimeStart))
+    {
+        std::cout << "Time windows or n2f in " << path << " don't make sense\n";
+        return false;
+    }
+
+    config = read;
+
+    return true;
+}
+
+// Bin edges for the binned directionality: either a comma separated list of edges, "0,1.5,2.5,4", or a number of
+// equal bins between low and high. Empty with a message if the spec can't be used
+inline std::vector<float> ReadBinEdges(std::string const& spec, float low, float high)
+{
+    std::vector<float> edges;
+
+    if (spec.find(',') == std::string::npos)
+    {
+        std::istringstream number(spec);
+        int bins;
+
+        if (!(number >> bins) || !(number >> std::ws).eof() || bins < 1)
+        {
+            std::cout << "Expected a number of bins of at least 1 or comma separated edges, got: " << spec << '\n';
+            return {};
+        }
+
+        for (int bin = 0; bin <= bins; bin++)
+        {
+            edges.push_back(bin == bins ? high : low + (high - low) * bin / bins);
+        }
+
+        return edges;
+    }
+
+    std::istringstream stream(spec);
+    std::string edge;
+
+    while (std::getline(stream, edge, ','))
+    {
+        std::istringstream number(edge);
+        float value;
+
+        if (!(number >> value) || !(number >> std::ws).eof())
+        {
+            std::cout << "Bad bin edge \"" << edge << "\" in: " << spec << '\n';
+            return {};
+        }
+
+        if (!edges.empty() && !(value > edges.back()))
+        {
+            std::cout << "Bin edges have to increase, got: " << spec << '\n';
+            return {};
+        }
+
+        edges.push_back(value);
+    }
+
+    if (edges.size() < 2)
+    {
+        std::cout << "Expected at least two bin edges, got: " << spec << '\n';
+        return {};
+    }
+
+    return edges;
+}
+
+// Bin of value between the edges, -1 outside. Bins include their low edge, and the last one its top edge too so a value
+// right on the upper cut limit is still counted
+inline int BinIndex(std::vector<float> const& edges, float value)
+{
+    if (edges.size() < 2 || !(value >= edges.front()) || value > edges.back())
+        return -1;
+
+    if (value == edges.back())
+        return edges.size() - 2;
+
+    return std::upper_bound(edges.begin(), edges.end(), value) - edges.begin() - 1;
+}
+
+// Reads a grid of cut values, one parameter per line followed by the values to try:
+//
+//   # comment
+//   lowAlphaPSD 0.15 0.17 0.19
+//   timeEnd 0.6 0.7 0.8
+//
+// and returns every combination, built on top of the nominal configuration. Empty if the file can't be used.
+inline std::vector<CutConfig> ReadCutGrid(std::string const& path, CutConfig const& nominal, float n2f)
+{
+    std::ifstream file(path);
+
+    if (!file.is_open())
+    {
+        std::cout << "Cut grid not found: " << path << '\n';
+        return {};
+    }
+
+    std::vector<CutConfig> grid{nominal};
+    grid[0].label = "";
+
+    std::string line;
+    int lineNumber = 0;
+
+    while (std::getline(file, line))
+    {
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream stream(line);
+        std::string name;
+
+        if (!(stream >> name))
+            continue;
+
+        auto parameter = ScanParameters().find(name);
+
+        if (parameter == ScanParameters().end())
+        {
+            std::cout << "Unknown cut " << name << " on line " << lineNumber << " of " << path << '\n';
+            return {};
+        }
+
+        std::vector<float> values;
+        float value;
+
+        while (stream >> value)
+        {
+            values.push_back(value);
+        }
+
+        if (values.empty() || !stream.eof())
+        {
+            std::cout << "Bad values for " << name << " on line " << lineNumber << " of " << path << '\n';
+            return {};
+        }
+
+        // Every configuration so far gets every value of this parameter
+        std::vector<CutConfig> expanded;
+
+        for (CutConfig const& config : grid)
+        {
+            for (float value : values)
+            {
+                CutConfig next = config;
+                next.*(parameter->second) = value;
+
+                std::ostringstream label;
+                label << (config.label.empty() ? "" : " ") << name << "=" << value;
+
+                next.label += label.str();
+                next.UpdateAccidentalWindow(n2f);
+                expanded.push_back(next);
+            }
+        }
+
+        grid = expanded;
+    }
+
+    return grid;
+}
+
+#endif
@@ -1,12 +1,48 @@
-#include <vector>
+#ifndef DETECTORCONFIG_H
+#define DETECTORCONFIG_H
 
-using std::vector;
+#include <array>
 
-vector<int> excludeList{0,   1,   2,   3,   4,   5,   6,   7,   8,   9,   10,  11,  12,  13,
-                        14,  17,  18,  21,  23,  24,  25,  26,  27,  28,  29,  31,  32,  34,
-                        36,  40,  41,  42,  43,  44,  46,  47,  48,  50,  52,  55,  56,  60,
-                        63,  68,  69,  70,  73,  79,  83,  84,  86,  87,  94,  97,  98,  102,
-                        107, 111, 112, 115, 121, 122, 125, 126, 127, 128, 130, 133, 136, 139,
-                        140, 141, 142, 143, 144, 145, 146, 147, 148, 149, 150, 151, 152, 153};
+#include "SegmentTable.h"
 
-vector<int> detectorConfig;
\ No newline at end of file
+// Dead or excluded segments from the start of data taking, sorted
+constexpr std::array excludeList{0,   1,   2,   3,   4,   5,   6,   7,   8,   9,   10,  11,  12,  13,
+                                 14,  17,  18,  21,  23,  24,  25,  26,  27,  28,  29,  31,  32,  34,
+                                 36,  40,  41,  42,  43,  44,  46,  47,  48,  50,  52,  55,  56,  60,
+                                 63,  68,  69,  70,  73,  79,  83,  84,  86,  87,  94,  97,  98,  102,
+                                 107, 111, 112, 115, 121, 122, 125, 126, 127, 128, 130, 133, 136, 139,
+                                 140, 141, 142, 143, 144, 145, 146, 147, 148, 149, 150, 151, 152, 153};
+
+// Configuration periods in time order, each starting at a run timestamp (the ts in the run name) and holding the tables
+// for every segment excluded from then on. A segment dying part way through data taking gets a new exclude list above
+// and a new period here; the first period has to start at 0.
+struct DetectorPeriod
+{
+    long long start;
+    SegmentTable segments;
+};
+
+inline constexpr std::array detectorPeriods{DetectorPeriod{0, SegmentTable{excludeList}}};
+
+static_assert(detectorPeriods[0].start == 0, "every run needs a period");
+static_assert(detectorPeriods[0].segments[-14].rejected && !detectorPeriods[0].segments[154].live,
+              "out of range segments are dead and rejected");
+static_assert(detectorPeriods[0].segments[15].x == 1 && detectorPeriods[0].segments[15].y == 1,
+              "segments are numbered column + 14 * row");
+
+// Period of a run from its timestamp in a list like detectorPeriods, found once per run. Runs without a ts (timestamp
+// 0) fall in the first period
+template <std::size_t periodCount>
+inline std::size_t DetectorPeriodAt(std::array<DetectorPeriod, periodCount> const& periods, long long timestamp)
+{
+    std::size_t period = 0;
+
+    while (period + 1 < periods.size() && periods[period + 1].start <= timestamp)
+    {
+        period++;
+    }
+
+    return period;
+}
+
+#endif
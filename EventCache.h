@@ -0,0 +1,398 @@
+#ifndef EVENTCACHE_H
+#define EVENTCACHE_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Skimmed BiPo candidates stored as structure-of-arrays columns. Only the cuts that never change are applied when
+// skimming (fiducial volume, |z| < 1000 mm and matching cluster multiplicities), everything else is left for the fill.
+//
+// File layout, native endianness:
+//   header        magic "BIPOSKIM", version, run/alpha/prompt/far counts
+//   run names     uint32 length + characters, one per run
+//   columns       run offsets, alpha columns, prompt columns, far columns
+// Every column starts on a 64 byte boundary so it can be used in place once the file is mapped, see MappedEventCache.
+// The counts and offsets are checked against the file length when it's mapped, a truncated or stale cache is refused.
+
+struct BetaColumns
+{
+    std::vector<std::uint64_t> offset{0};  // First beta of each alpha, one extra entry at the end
+    std::vector<std::uint8_t> segment;
+    std::vector<std::int16_t> index;  // Position in the plugin's window, used for the multiplicity histograms
+    std::vector<float> energy;
+    std::vector<float> psd;
+    std::vector<float> z;
+    std::vector<float> deltaTime;  // alpha - beta for prompt, beta - alpha for far, in us
+
+    std::size_t Size() const { return segment.size(); }
+
+    void Add(int betaIndex, int betaSegment, float betaEnergy, float betaPSD, float betaZ, float betaDeltaTime)
+    {
+        segment.push_back(betaSegment);
+        index.push_back(betaIndex);
+        energy.push_back(betaEnergy);
+        psd.push_back(betaPSD);
+        z.push_back(betaZ);
+        deltaTime.push_back(betaDeltaTime);
+        offset.back() = segment.size();
+    }
+};
+
+class EventCache
+{
+  public:
+    static constexpr char magic[8] = {'B', 'I', 'P', 'O', 'S', 'K', 'I', 'M'};
+    static constexpr std::uint32_t version = 1;
+    static constexpr std::size_t columnAlignment = 64;
+
+    std::vector<std::string> runs;
+    std::vector<std::uint64_t> runOffset{0};  // First alpha of each run, one extra entry at the end
+
+    // Alpha columns
+    std::vector<std::uint8_t> alphaSegment;
+    std::vector<float> alphaEnergy;
+    std::vector<float> alphaPSD;
+    std::vector<float> alphaZ;
+
+    // Beta columns for the correlated and accidental windows
+    BetaColumns prompt, far;
+
+    std::size_t Runs() const { return runs.size(); }
+    std::size_t Alphas() const { return alphaSegment.size(); }
+
+    void BeginRun(std::string const& run)
+    {
+        runs.push_back(run);
+        runOffset.push_back(runOffset.back());
+    }
+
+    void AddAlpha(int segment, float energy, float psd, float z)
+    {
+        alphaSegment.push_back(segment);
+        alphaEnergy.push_back(energy);
+        alphaPSD.push_back(psd);
+        alphaZ.push_back(z);
+        runOffset.back() = alphaSegment.size();
+        prompt.offset.push_back(prompt.Size());
+        far.offset.push_back(far.Size());
+    }
+
+    // Runs from another cache go after ours, offsets are shifted to match
+    void Append(EventCache const& other)
+    {
+        std::uint64_t alphaShift = Alphas();
+
+        runs.insert(runs.end(), other.runs.begin(), other.runs.end());
+
+        for (std::size_t run = 1; run < other.runOffset.size(); run++)
+        {
+            runOffset.push_back(other.runOffset[run] + alphaShift);
+        }
+
+        alphaSegment.insert(alphaSegment.end(), other.alphaSegment.begin(), other.alphaSegment.end());
+        alphaEnergy.insert(alphaEnergy.end(), other.alphaEnergy.begin(), other.alphaEnergy.end());
+        alphaPSD.insert(alphaPSD.end(), other.alphaPSD.begin(), other.alphaPSD.end());
+        alphaZ.insert(alphaZ.end(), other.alphaZ.begin(), other.alphaZ.end());
+
+        AppendBetas(prompt, other.prompt);
+        AppendBetas(far, other.far);
+    }
+
+    bool Write(std::string const& path) const
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+        if (!file.is_open())
+            return false;
+
+        std::uint64_t counts[4] = {Runs(), Alphas(), prompt.Size(), far.Size()};
+        std::uint32_t reserved = 0;
+
+        file.write(magic, sizeof(magic));
+        file.write(reinterpret_cast<char const*>(&version), sizeof(version));
+        file.write(reinterpret_cast<char const*>(&reserved), sizeof(reserved));
+        file.write(reinterpret_cast<char const*>(counts), sizeof(counts));
+
+        for (auto const& run : runs)
+        {
+            std::uint32_t length = run.size();
+            file.write(reinterpret_cast<char const*>(&length), sizeof(length));
+            file.write(run.data(), length);
+        }
+
+        WriteColumn(file, runOffset);
+        WriteColumn(file, alphaSegment);
+        WriteColumn(file, alphaEnergy);
+        WriteColumn(file, alphaPSD);
+        WriteColumn(file, alphaZ);
+
+        for (BetaColumns const* betas : {&prompt, &far})
+        {
+            WriteColumn(file, betas->offset);
+            WriteColumn(file, betas->segment);
+            WriteColumn(file, betas->index);
+            WriteColumn(file, betas->energy);
+            WriteColumn(file, betas->psd);
+            WriteColumn(file, betas->z);
+            WriteColumn(file, betas->deltaTime);
+        }
+
+        return file.good();
+    }
+
+  private:
+    static void AppendBetas(BetaColumns& betas, BetaColumns const& other)
+    {
+        std::uint64_t betaShift = betas.Size();
+
+        for (std::size_t alpha = 1; alpha < other.offset.size(); alpha++)
+        {
+            betas.offset.push_back(other.offset[alpha] + betaShift);
+        }
+
+        betas.segment.insert(betas.segment.end(), other.segment.begin(), other.segment.end());
+        betas.index.insert(betas.index.end(), other.index.begin(), other.index.end());
+        betas.energy.insert(betas.energy.end(), other.energy.begin(), other.energy.end());
+        betas.psd.insert(betas.psd.end(), other.psd.begin(), other.psd.end());
+        betas.z.insert(betas.z.end(), other.z.begin(), other.z.end());
+        betas.deltaTime.insert(betas.deltaTime.end(), other.deltaTime.begin(), other.deltaTime.end());
+    }
+
+    template <typename T>
+    static void WriteColumn(std::ofstream& file, std::vector<T> const& column)
+    {
+        static char const padding[columnAlignment] = {};
+
+        std::size_t position = file.tellp();
+        file.write(padding, (columnAlignment - position % columnAlignment) % columnAlignment);
+        file.write(reinterpret_cast<char const*>(column.data()), column.size() * sizeof(T));
+    }
+};
+
+// Read-only column living inside a mapped event cache
+template <typename T>
+struct Column
+{
+    T const* data = nullptr;
+    std::size_t size = 0;
+
+    T const& operator[](std::size_t i) const { return data[i]; }
+};
+
+struct BetaColumnView
+{
+    Column<std::uint64_t> offset;
+    Column<std::uint8_t> segment;
+    Column<std::int16_t> index;
+    Column<float> energy;
+    Column<float> psd;
+    Column<float> z;
+    Column<float> deltaTime;
+
+    std::size_t Size() const { return segment.size; }
+};
+
+// Event cache mapped straight from disk. Columns point into the page cache so repeated passes on the same node don't
+// reread the file, and Release() drops a finished run's pages from our mapping so the resident set doesn't grow with the
+// size of the cache.
+class MappedEventCache
+{
+  public:
+    std::vector<std::string> runs;
+    Column<std::uint64_t> runOffset;
+
+    // Alpha columns
+    Column<std::uint8_t> alphaSegment;
+    Column<float> alphaEnergy;
+    Column<float> alphaPSD;
+    Column<float> alphaZ;
+
+    // Beta columns for the correlated and accidental windows
+    BetaColumnView prompt, far;
+
+    MappedEventCache() = default;
+    MappedEventCache(MappedEventCache const&) = delete;
+    MappedEventCache& operator=(MappedEventCache const&) = delete;
+
+    ~MappedEventCache()
+    {
+        if (mapping)
+            munmap(mapping, mappingSize);
+    }
+
+    std::size_t Runs() const { return runs.size(); }
+    std::size_t Alphas() const { return alphaSegment.size; }
+
+    bool Open(std::string const& path)
+    {
+        int descriptor = open(path.c_str(), O_RDONLY);
+
+        if (descriptor < 0)
+            return false;
+
+        struct stat status;
+
+        if (fstat(descriptor, &status) != 0 || (std::size_t)status.st_size < headerSize)
+        {
+            close(descriptor);
+            return false;
+        }
+
+        mappingSize = status.st_size;
+        mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, descriptor, 0);
+        close(descriptor);
+
+        if (mapping == MAP_FAILED)
+        {
+            mapping = nullptr;
+            return false;
+        }
+
+        // Columns are read front to back, one run at a time
+        madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+
+        char const* base = static_cast<char const*>(mapping);
+        std::uint32_t fileVersion;
+        std::uint64_t counts[4];
+
+        std::memcpy(&fileVersion, base + sizeof(EventCache::magic), sizeof(fileVersion));
+        std::memcpy(counts, base + sizeof(EventCache::magic) + 2 * sizeof(std::uint32_t), sizeof(counts));
+
+        if (std::memcmp(base, EventCache::magic, sizeof(EventCache::magic)) != 0 || fileVersion != EventCache::version)
+            return false;
+
+        position = headerSize;
+
+        // Every run name takes at least its length word, so a count larger than that can't be right
+        if (counts[0] > (mappingSize - position) / sizeof(std::uint32_t))
+            return false;
+
+        runs.resize(counts[0]);
+
+        for (auto& run : runs)
+        {
+            std::uint32_t length;
+
+            if (!Fits(sizeof(length)))
+                return false;
+
+            std::memcpy(&length, base + position, sizeof(length));
+            position += sizeof(length);
+
+            if (!Fits(length))
+                return false;
+
+            run.assign(base + position, length);
+            position += length;
+        }
+
+        bool good = MapColumn(runOffset, counts[0] + 1) && MapColumn(alphaSegment, counts[1])
+                    && MapColumn(alphaEnergy, counts[1]) && MapColumn(alphaPSD, counts[1]) && MapColumn(alphaZ, counts[1]);
+
+        for (int window = 0; window < 2; window++)
+        {
+            BetaColumnView& betas = window == 0 ? prompt : far;
+            std::uint64_t betaCount = counts[2 + window];
+
+            good = good && MapColumn(betas.offset, counts[1] + 1) && MapColumn(betas.segment, betaCount)
+                   && MapColumn(betas.index, betaCount) && MapColumn(betas.energy, betaCount)
+                   && MapColumn(betas.psd, betaCount) && MapColumn(betas.z, betaCount)
+                   && MapColumn(betas.deltaTime, betaCount);
+
+            // Fill loops index the beta columns through these offsets without checking them
+            good = good && ValidOffsets(betas.offset, betaCount);
+        }
+
+        return good && ValidOffsets(runOffset, counts[1]);
+    }
+
+    // Done with this run, its pages stay in the page cache but leave our resident set
+    void Release(std::size_t run) const
+    {
+        std::uint64_t firstAlpha = runOffset[run], lastAlpha = runOffset[run + 1];
+
+        ReleaseRange(alphaSegment, firstAlpha, lastAlpha);
+        ReleaseRange(alphaEnergy, firstAlpha, lastAlpha);
+        ReleaseRange(alphaPSD, firstAlpha, lastAlpha);
+        ReleaseRange(alphaZ, firstAlpha, lastAlpha);
+
+        for (BetaColumnView const* betas : {&prompt, &far})
+        {
+            std::uint64_t firstBeta = betas->offset[firstAlpha], lastBeta = betas->offset[lastAlpha];
+
+            ReleaseRange(betas->offset, firstAlpha, lastAlpha);
+            ReleaseRange(betas->segment, firstBeta, lastBeta);
+            ReleaseRange(betas->index, firstBeta, lastBeta);
+            ReleaseRange(betas->energy, firstBeta, lastBeta);
+            ReleaseRange(betas->psd, firstBeta, lastBeta);
+            ReleaseRange(betas->z, firstBeta, lastBeta);
+            ReleaseRange(betas->deltaTime, firstBeta, lastBeta);
+        }
+    }
+
+  private:
+    static constexpr std::size_t headerSize = sizeof(EventCache::magic) + 2 * sizeof(std::uint32_t) + 4 * sizeof(std::uint64_t);
+
+    void* mapping = nullptr;
+    std::size_t mappingSize = 0;
+    std::size_t position = 0;
+
+    bool Fits(std::size_t bytes) const { return position <= mappingSize && bytes <= mappingSize - position; }
+
+    template <typename T>
+    bool MapColumn(Column<T>& column, std::size_t size)
+    {
+        position += (EventCache::columnAlignment - position % EventCache::columnAlignment) % EventCache::columnAlignment;
+
+        // Dividing instead of multiplying, a corrupt count would overflow size * sizeof(T)
+        if (position > mappingSize || size > (mappingSize - position) / sizeof(T))
+            return false;
+
+        column.data = reinterpret_cast<T const*>(static_cast<char const*>(mapping) + position);
+        column.size = size;
+        position += size * sizeof(T);
+
+        return true;
+    }
+
+    // Offsets have to start at 0, never go down and end at the size of the column they point into
+    static bool ValidOffsets(Column<std::uint64_t> const& offsets, std::uint64_t end)
+    {
+        if (offsets.size == 0 || offsets[0] != 0 || offsets[offsets.size - 1] != end)
+            return false;
+
+        for (std::size_t i = 1; i < offsets.size; i++)
+        {
+            if (offsets[i] < offsets[i - 1])
+                return false;
+        }
+
+        return true;
+    }
+
+    // Only whole pages inside the range are dropped, the ones shared with neighbouring runs are left alone
+    template <typename T>
+    static void ReleaseRange(Column<T> const& column, std::uint64_t first, std::uint64_t last)
+    {
+        static std::size_t const pageSize = sysconf(_SC_PAGESIZE);
+
+        std::uintptr_t begin = reinterpret_cast<std::uintptr_t>(column.data + first);
+        std::uintptr_t end = reinterpret_cast<std::uintptr_t>(column.data + last);
+
+        begin = (begin + pageSize - 1) / pageSize * pageSize;
+        end = end / pageSize * pageSize;
+
+        if (begin < end)
+            madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+    }
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef FILELIST_H
+#define FILELIST_H
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <glob.h>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// Building the run list. A list source is either a text file with one run name per line or, if it contains a wildcard,
+// a glob over run names: the pattern takes the place of %s in dataFileName and the ROOT files it matches give the runs,
+// e.g. "Synthetic/series00*/*" with dataFileName "data/%s/AD1_BiPo.root". Sources are read in order, and a run listed
+// twice is only kept the first time so shards and run caches never see it twice.
+
+inline bool HasWildcard(std::string const& source)
+{
+    return source.find_first_of("*?[") != std::string::npos;
+}
+
+// Several sources in one setting, separated by commas
+inline std::vector<std::string> SplitSources(std::string const& sources)
+{
+    std::vector<std::string> split;
+    std::size_t start = 0;
+
+    while (start <= sources.size())
+    {
+        std::size_t end = std::min(sources.find(',', start), sources.size());
+
+        if (end > start)
+            split.push_back(sources.substr(start, end - start));
+
+        start = end + 1;
+    }
+
+    return split;
+}
+
+// Blank lines and trailing whitespace are skipped, they used to turn into runs with an empty name
+inline bool ReadRunList(std::string const& path, std::vector<std::string>& runs)
+{
+    std::ifstream file(path);
+
+    if (!file.is_open())
+        return false;
+
+    std::string line;
+
+    while (std::getline(file, line))
+    {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+
+        if (!line.empty())
+            runs.push_back(line);
+    }
+
+    return true;
+}
+
+// Runs whose ROOT file matches the pattern, sorted by name. Returns how many matched
+inline std::size_t ExpandRunGlob(std::string const& pattern, std::string const& fileName, std::vector<std::string>& runs)
+{
+    std::size_t marker = fileName.find("%s");
+
+    if (marker == std::string::npos)
+        return 0;
+
+    std::string prefix = fileName.substr(0, marker), suffix = fileName.substr(marker + 2);
+    glob_t matches;
+
+    if (glob((prefix + pattern + suffix).c_str(), 0, nullptr, &matches) != 0)
+    {
+        globfree(&matches);
+        return 0;
+    }
+
+    for (std::size_t i = 0; i < matches.gl_pathc; i++)
+    {
+        std::string path = matches.gl_pathv[i];
+        runs.push_back(path.substr(prefix.size(), path.size() - prefix.size() - suffix.size()));
+    }
+
+    globfree(&matches);
+
+    return matches.gl_pathc;
+}
+
+// Drops repeated runs, keeping the first. Returns how many were dropped
+inline std::size_t RemoveDuplicateRuns(std::vector<std::string>& runs)
+{
+    std::unordered_set<std::string> seen;
+    std::size_t before = runs.size();
+
+    runs.erase(std::remove_if(runs.begin(), runs.end(), [&seen](std::string const& run) { return !seen.insert(run).second; }),
+               runs.end());
+
+    return before - runs.size();
+}
+
+// Calls look(i) for every i below count from several threads, for per-run lookups that mostly wait on the file system
+template <typename Function>
+void ForEachParallel(std::size_t count, int threads, Function look)
+{
+    std::atomic<std::size_t> next = 0;
+    std::vector<std::thread> pool;
+
+    for (int thread = 0; thread < std::max(threads, 1); thread++)
+    {
+        pool.emplace_back(
+            [&]()
+            {
+                for (std::size_t i = next++; i < count; i = next++)
+                {
+                    look(i);
+                }
+            });
+    }
+
+    for (auto& thread : pool)
+    {
+        thread.join();
+    }
+}
+
+// Size of every file, -1 for the ones that don't exist
+inline std::vector<long long> FileSizes(std::vector<std::string> const& paths, int threads)
+{
+    std::vector<long long> sizes(paths.size(), -1);
+
+    ForEachParallel(paths.size(), threads,
+                    [&](std::size_t i)
+                    {
+                        std::error_code error;
+                        auto size = std::filesystem::file_size(paths[i], error);
+
+                        if (!error)
+                            sizes[i] = size;
+                    });
+
+    return sizes;
+}
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef FIXEDHISTOGRAM_H
+#define FIXEDHISTOGRAM_H
+
+#include <array>
+#include <cstddef>
+
+// Histogram with its binning fixed at compile time, used while filling in place of TH1::Fill. CopyTo() hands the bin
+// contents, sum of squared weights, entries and statistics ROOT keeps to a TH1 with the same binning at the end. Nothing
+// else here needs ROOT, so the histogram can be checked without it.
+//
+// Every fill of one histogram uses the same weight, so only unit counts are kept and the weight is applied in CopyTo().
+// The x and x^2 sums are kept in fixed point with 32 fractional bits. Every sum is then an integer and adding partial
+// histograms, from workers, the run cache or shards, gives exactly the same result as one serial pass.
+//
+// Axis provides bins, min and max. Content is double for TH1D and long long for TH1I, where ROOT truncates every weight
+// to an integer before adding it.
+template <typename Axis, typename Content = double>
+class FixedHistogram
+{
+  public:
+    static constexpr int bins = Axis::bins;
+    static constexpr double min = Axis::min, max = Axis::max;
+
+    // x^2 of any value inside the axis has to fit a 64 bit integer after scaling
+    static_assert(max * max < 0x1.0p30 && min * min < 0x1.0p30, "axis too wide for the fixed point sums");
+
+    // Same bin TAxis::FindBin picks for a fixed width axis, 0 and bins + 1 are under and overflow
+    static inline int FindBin(double x)
+    {
+        if (x < min)
+            return 0;
+
+        if (!(x < max))
+            return bins + 1;
+
+        return 1 + int(bins * (x - min) / (max - min));
+    }
+
+    inline void Fill(double x, double w = 1)
+    {
+        int bin = FindBin(x);
+
+        weight = w;
+        counts[bin]++;
+
+        // Under and overflows don't count towards the statistics
+        if (bin == 0 || bin > bins)
+            return;
+
+        inRange++;
+        sumX += ToFixed(x);
+        sumX2 += ToFixed(x * x);
+    }
+
+    // Adds the other histogram as if it had been filled times times over, a negative count takes it back out
+    void Add(FixedHistogram const& other, int times = 1)
+    {
+        for (int bin = 0; bin < bins + 2; bin++)
+        {
+            counts[bin] += times * other.counts[bin];
+        }
+
+        inRange += times * other.inRange;
+        sumX += times * other.sumX;
+        sumX2 += times * other.sumX2;
+
+        if (other.weight != 1)
+            weight = other.weight;
+    }
+
+    void Reset() { *this = FixedHistogram(); }
+
+    double Entries() const { return Total(); }
+    Content BinContent(int bin) const { return counts[bin] * Content(weight); }
+    double BinSumw2(int bin) const { return counts[bin] * (weight * weight); }
+
+    // sum w, sum w^2, sum wx, sum wx^2 over the bins inside the axis, what TH1::PutStats takes
+    std::array<double, 4> Stats() const
+    {
+        return {inRange * weight, inRange * (weight * weight), weight * FromFixed(sumX), weight * FromFixed(sumX2)};
+    }
+
+    // Overwrites the TH1 with our contents. Errors are only stored if a weight other than one was used, like TH1::Fill
+    template <typename Histogram>
+    void CopyTo(Histogram& histogram) const
+    {
+        histogram.Reset();
+
+        for (int bin = 0; bin < bins + 2; bin++)
+        {
+            histogram.SetBinContent(bin, BinContent(bin));
+        }
+
+        if (weight != 1 && Total() > 0)
+        {
+            histogram.Sumw2();
+
+            for (int bin = 0; bin < bins + 2; bin++)
+            {
+                histogram.GetSumw2()->SetAt(BinSumw2(bin), bin);
+            }
+        }
+
+        std::array<double, 4> stats = Stats();
+        histogram.PutStats(stats.data());
+        histogram.SetEntries(Total());
+    }
+
+  private:
+    std::array<long long, bins + 2> counts{};
+    long long inRange = 0;
+    __int128 sumX = 0, sumX2 = 0;
+    double weight = 1;
+
+    // Rounding happens once per value, so the sums don't depend on the order they're added in
+    static inline long long ToFixed(double value) { return (long long)(value * 0x1.0p32); }
+    static inline double FromFixed(__int128 value) { return (double)value * 0x1.0p-32; }
+
+    double Total() const
+    {
+        long long total = 0;
+
+        for (long long count : counts)
+        {
+            total += count;
+        }
+
+        return total;
+    }
+};
+
+// Axes of the BiPo histograms, shared by the TH1s the analysis writes and the FixedHistograms filled in their place
+struct XAxis
+{
+    static constexpr int bins = 301;
+    static constexpr double min = -150.5, max = 150.5;  // mm, one bin per mm centered on 0
+};
+
+struct ZAxis
+{
+    static constexpr int bins = 501;
+    static constexpr double min = -250.5, max = 250.5;
+};
+
+struct MultiplicityAxis
+{
+    static constexpr int bins = 9;
+    static constexpr double min = 1, max = 9;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef RESAMPLING_H
+#define RESAMPLING_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+// Replicas of the run list for the bootstrap and jackknife error estimates. A bootstrap replica draws as many runs as
+// there are, with replacement, and counts each run as often as it was drawn. A jackknife replica leaves out one block
+// of consecutive runs, every run its own block for leave-one-run-out. Replicas only depend on their number and the
+// seed, so they come out the same whichever thread evaluates them.
+
+inline constexpr std::uint64_t resampleSeed = 20190101;
+
+// How often every run is drawn in bootstrap replica number replica
+inline void BootstrapMultiplicities(std::size_t runs, std::size_t replica, std::vector<int>& times)
+{
+    std::mt19937_64 generator(resampleSeed + replica);
+    std::uniform_int_distribution<std::size_t> draw(0, runs - 1);
+
+    times.assign(runs, 0);
+
+    for (std::size_t i = 0; i < runs; i++)
+    {
+        times[draw(generator)]++;
+    }
+}
+
+// First and one past the last run of a jackknife block, blocks differ in length by at most one run
+inline std::pair<std::size_t, std::size_t> JackknifeBlock(std::size_t block, std::size_t blocks, std::size_t runs)
+{
+    return {block * runs / blocks, (block + 1) * runs / blocks};
+}
+
+// Standard deviation of the replicas for the bootstrap. The jackknife spread is scaled up by (n - 1), since each
+// replica shares all but one block with the others
+inline double ResampledSpread(std::vector<double> const& values, bool jackknife)
+{
+    std::size_t n = values.size();
+
+    if (n < 2)
+        return 0;
+
+    double sum = 0;
+
+    for (double value : values)
+    {
+        sum += value;
+    }
+
+    double average = sum / n, squares = 0;
+
+    for (double value : values)
+    {
+        squares += (value - average) * (value - average);
+    }
+
+    return jackknife ? std::sqrt(squares * (n - 1) / n) : std::sqrt(squares / (n - 1));
+}
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef RUNCACHE_H
+#define RUNCACHE_H
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+// Per-run partial counts kept on disk between jobs, so a rerun only reads the runs that were added or changed. Every
+// ROOT file gets one partial file in the cache directory, named after a hash of its path and overwritten whenever the
+// run is read again.
+//
+// The same partial format holds the counts of a whole shard, see BiPo::WriteShard.
+//
+// File layout, native endianness:
+//   header        magic "BIPOPART", version, size of one count set, number of count sets
+//   key           ROOT file size and modification time, hash of the cuts, uint32 length + label (the run path)
+//   counts        the count sets, copied byte for byte
+// A partial is only used if every header and key field matches the current run and cuts.
+
+// FNV-1a, enough to tell cut sets and paths apart
+inline std::uint64_t HashBytes(void const* data, std::size_t size, std::uint64_t hash = 14695981039346656037ull)
+{
+    auto bytes = static_cast<unsigned char const*>(data);
+
+    for (std::size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+struct RunKey
+{
+    std::uint64_t size = 0;
+    std::int64_t modified = 0;
+    std::uint64_t cutHash = 0;
+};
+
+inline constexpr char partialMagic[8] = {'B', 'I', 'P', 'O', 'P', 'A', 'R', 'T'};
+inline constexpr std::uint32_t partialVersion = 2;
+
+// Reads count sets written by WritePartial, only if the label and key match what the caller expects
+template <typename Counts>
+bool ReadPartial(std::string const& partialPath, std::string const& label, RunKey const& key, std::vector<Counts>& counts)
+{
+    static_assert(std::is_trivially_copyable_v<Counts>, "partials are copied byte for byte");
+
+    std::ifstream file(partialPath, std::ios::binary);
+
+    if (!file.is_open())
+        return false;
+
+    char fileMagic[sizeof(partialMagic)];
+    std::uint32_t fileVersion, countSize, countSets, labelLength;
+    RunKey stored;
+
+    file.read(fileMagic, sizeof(fileMagic));
+    file.read(reinterpret_cast<char*>(&fileVersion), sizeof(fileVersion));
+    file.read(reinterpret_cast<char*>(&countSize), sizeof(countSize));
+    file.read(reinterpret_cast<char*>(&countSets), sizeof(countSets));
+    file.read(reinterpret_cast<char*>(&stored), sizeof(stored));
+    file.read(reinterpret_cast<char*>(&labelLength), sizeof(labelLength));
+
+    if (!file || std::memcmp(fileMagic, partialMagic, sizeof(partialMagic)) != 0 || fileVersion != partialVersion
+        || countSize != sizeof(Counts) || countSets != counts.size() || stored.size != key.size
+        || stored.modified != key.modified || stored.cutHash != key.cutHash || labelLength != label.size())
+        return false;
+
+    std::string storedLabel(labelLength, '\0');
+    file.read(storedLabel.data(), labelLength);
+
+    if (!file || storedLabel != label)
+        return false;
+
+    std::vector<Counts> loaded(counts.size());
+    file.read(reinterpret_cast<char*>(loaded.data()), loaded.size() * sizeof(Counts));
+
+    if (!file)
+        return false;
+
+    counts = std::move(loaded);
+
+    return true;
+}
+
+// Written next to the target and renamed over it, so an interrupted job never leaves a torn file behind
+template <typename Counts>
+bool WritePartial(std::string const& partialPath, std::string const& label, RunKey const& key,
+                  std::vector<Counts> const& counts)
+{
+    static_assert(std::is_trivially_copyable_v<Counts>, "partials are copied byte for byte");
+
+    std::string temporaryPath = partialPath + ".tmp";
+    std::ofstream file(temporaryPath, std::ios::binary);
+
+    if (!file.is_open())
+        return false;
+
+    std::uint32_t countSize = sizeof(Counts), countSets = counts.size(), labelLength = label.size();
+
+    file.write(partialMagic, sizeof(partialMagic));
+    file.write(reinterpret_cast<char const*>(&partialVersion), sizeof(partialVersion));
+    file.write(reinterpret_cast<char const*>(&countSize), sizeof(countSize));
+    file.write(reinterpret_cast<char const*>(&countSets), sizeof(countSets));
+    file.write(reinterpret_cast<char const*>(&key), sizeof(key));
+    file.write(reinterpret_cast<char const*>(&labelLength), sizeof(labelLength));
+    file.write(label.data(), labelLength);
+    file.write(reinterpret_cast<char const*>(counts.data()), counts.size() * sizeof(Counts));
+    file.close();
+
+    std::error_code error;
+
+    if (!file)
+    {
+        std::filesystem::remove(temporaryPath, error);
+        return false;
+    }
+
+    std::filesystem::rename(temporaryPath, partialPath, error);
+
+    return !error;
+}
+
+class RunCache
+{
+  public:
+    RunCache(std::string const& directory, std::uint64_t cutHash) : directory(directory), cutHash(cutHash)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+    }
+
+    // False if the ROOT file can't be looked at, in which case the run is always read
+    bool Key(std::string const& path, RunKey& key) const
+    {
+        std::error_code error;
+
+        key.size = std::filesystem::file_size(path, error);
+
+        if (error)
+            return false;
+
+        key.modified = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+        key.cutHash = cutHash;
+
+        return !error;
+    }
+
+    template <typename Counts>
+    bool Load(std::string const& path, std::vector<Counts>& counts) const
+    {
+        RunKey key;
+
+        return Key(path, key) && ReadPartial(PartialPath(path), path, key, counts);
+    }
+
+    template <typename Counts>
+    void Save(std::string const& path, std::vector<Counts> const& counts) const
+    {
+        RunKey key;
+
+        if (Key(path, key))
+            WritePartial(PartialPath(path), path, key, counts);
+    }
+
+  private:
+    std::string directory;
+    std::uint64_t cutHash;
+
+    std::string PartialPath(std::string const& path) const
+    {
+        std::ostringstream name;
+        name << directory << '/' << std::hex << std::setw(16) << std::setfill('0') << HashBytes(path.data(), path.size())
+             << ".part";
+
+        return name.str();
+    }
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef SEGMENTTABLE_H
+#define SEGMENTTABLE_H
+
+#include <array>
+#include <cstdint>
+
+// Everything the per-candidate code asks about a segment, worked out once at compile time from an exclude list: its
+// column and row, whether the fiducial cut rejects it, whether it's live and which of its four neighbours are live.
+// Segments are numbered column + 14 * row from the bottom left. DetectorConfig.h holds one table per detector period.
+//
+// Lookups of segments outside the detector get an entry that is dead, fiducially rejected and has no live neighbours,
+// so a bad segment number can never read past the table.
+enum NeighborBits : std::uint8_t
+{
+    NeighborRight = 1,
+    NeighborLeft = 2,
+    NeighborUp = 4,
+    NeighborDown = 8
+};
+
+struct SegmentInfo
+{
+    std::int8_t x = -1, y = -1;
+    bool rejected = true;  // Fails the fiducial cut
+    bool live = false;
+    std::uint8_t neighbors = 0;  // NeighborBits of the live neighbours
+
+    constexpr bool Neighbor(NeighborBits direction) const { return neighbors & direction; }
+};
+
+class SegmentTable
+{
+  public:
+    static constexpr int columns = 14, rows = 11, segments = columns * rows;
+
+    template <std::size_t N>
+    constexpr explicit SegmentTable(std::array<int, N> const& excluded)
+    {
+        std::array<bool, segments> live{};
+
+        for (int segment = 0; segment < segments; segment++)
+        {
+            live[segment] = true;
+        }
+
+        for (int segment : excluded)
+        {
+            if (segment >= 0 && segment < segments)
+                live[segment] = false;
+        }
+
+        for (int segment = 0; segment < segments; segment++)
+        {
+            int x = segment % columns, y = segment / columns;
+            SegmentInfo& info = table[segment];
+
+            info.x = x;
+            info.y = y;
+            info.rejected = Rejected(segment);
+            info.live = live[segment];
+
+            // Neighbours off the edge of the detector count as dead
+            if (x + 1 < columns && live[segment + 1])
+                info.neighbors |= NeighborRight;
+
+            if (x > 0 && live[segment - 1])
+                info.neighbors |= NeighborLeft;
+
+            if (y + 1 < rows && live[segment + columns])
+                info.neighbors |= NeighborUp;
+
+            if (y > 0 && live[segment - columns])
+                info.neighbors |= NeighborDown;
+        }
+    }
+
+    constexpr SegmentInfo const& operator[](int segment) const
+    {
+        return (static_cast<unsigned>(segment) < static_cast<unsigned>(segments)) ? table[segment] : outside;
+    }
+
+  private:
+    std::array<SegmentInfo, segments> table{};
+    SegmentInfo outside{};
+
+    // Outer columns, top row and the two segments next to the calibration tubes
+    static constexpr bool Rejected(int segment)
+    {
+        return segment >= 140 || segment % columns == 0 || (segment + 1) % columns == 0 || segment == 25 || segment == 26;
+    }
+};
+
+#endif
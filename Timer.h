@@ -1,16 +1,485 @@
 #ifndef TIMER_H
 #define TIMER_H
 
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 
+// Nested timing scopes. Every thread records into its own tree of named scopes, so timing a scope never takes a lock:
+// a ProfileScope looks up (or adds) its name among the children of the scope that is open on its thread, reads the
+// clock when it opens and closes, and adds the duration to that node's count, total, min, max and a log-scale histogram
+// used for the p99. The trees of all threads are merged by scope path for the report.
+//
+// Loops too hot for a scope per iteration split their time with a PhaseTimer instead, and whole runs can be kept in a
+// list of the slowest ones so a single slow file stands out from the merged totals.
+//
+// Nothing is recorded unless Profiler::enabled is set, a disabled scope costs one branch.
+class Profiler
+{
+  public:
+    static inline bool enabled = false;
+
+    // Durations are bucketed by power of two of their nanoseconds, split into subBuckets steps each
+    static constexpr int octaves = 48, subBuckets = 8;
+
+    struct Node
+    {
+        char const* name;
+        int parent;
+        std::vector<int> children;
+
+        long long count = 0;
+        std::int64_t total = 0, min = std::numeric_limits<std::int64_t>::max(), max = 0;  // Nanoseconds
+        std::array<std::uint32_t, octaves * subBuckets> buckets{};
+
+        inline void Add(std::int64_t nanoseconds)
+        {
+            count++;
+            total += nanoseconds;
+            min = std::min(min, nanoseconds);
+            max = std::max(max, nanoseconds);
+            buckets[Bucket(nanoseconds)]++;
+        }
+
+        void Add(Node const& other)
+        {
+            count += other.count;
+            total += other.total;
+            min = std::min(min, other.min);
+            max = std::max(max, other.max);
+
+            for (std::size_t bucket = 0; bucket < buckets.size(); bucket++)
+            {
+                buckets[bucket] += other.buckets[bucket];
+            }
+        }
+
+        // Upper edge of the bucket holding the 99th percentile, never above the slowest time seen
+        std::int64_t P99() const
+        {
+            long long below = 0, target = std::ceil(0.99 * count);
+
+            for (std::size_t bucket = 0; bucket < buckets.size(); bucket++)
+            {
+                below += buckets[bucket];
+
+                if (below >= target)
+                    return std::min(max, BucketEdge(bucket + 1));
+            }
+
+            return max;
+        }
+    };
+
+    static constexpr std::size_t slowestKept = 10;
+
+    struct ThreadProfile
+    {
+        std::string name;
+        std::vector<Node> nodes{Node{"", -1, {}}};  // Node 0 is the thread itself
+        int current = 0;
+        std::vector<std::pair<std::int64_t, std::string>> slowest;  // Slowest first
+
+        void KeepSlowest(std::int64_t nanoseconds, std::string const& item)
+        {
+            if (slowest.size() == slowestKept && nanoseconds <= slowest.back().first)
+                return;
+
+            auto position = std::upper_bound(slowest.begin(), slowest.end(), nanoseconds,
+                                             [](std::int64_t time, auto const& kept) { return time > kept.first; });
+            slowest.insert(position, {nanoseconds, item});
+
+            if (slowest.size() > slowestKept)
+                slowest.pop_back();
+        }
+
+        int Child(int parent, char const* name)
+        {
+            for (int child : nodes[parent].children)
+            {
+                if (nodes[child].name == name || std::strcmp(nodes[child].name, name) == 0)
+                    return child;
+            }
+
+            nodes.push_back(Node{name, parent, {}});
+            nodes[parent].children.push_back(nodes.size() - 1);
+
+            return nodes.size() - 1;
+        }
+    };
+
+    static Profiler& Get()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    // The calling thread's tree, created on first use
+    ThreadProfile& Thread()
+    {
+        thread_local ThreadProfile* local = nullptr;
+
+        if (!local)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            threads.push_back(std::make_unique<ThreadProfile>());
+            local = threads.back().get();
+            local->name = (threads.size() == 1) ? "Main" : "Thread " + std::to_string(threads.size() - 1);
+        }
+
+        return *local;
+    }
+
+    void NameThread(std::string const& name)
+    {
+        if (enabled)
+            Thread().name = name;
+    }
+
+    // Keeps item if it's among the slowest seen on this thread, e.g. a run and the time its scope took
+    void RecordSlowest(std::string const& item, std::int64_t nanoseconds)
+    {
+        if (enabled)
+            Thread().KeepSlowest(nanoseconds, item);
+    }
+
+    // Only call once every thread that recorded anything has been joined
+    void Report(std::ostream& out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        ThreadProfile merged = Merged();
+
+        out << "--------------------------------------------\n";
+        out << "Profile, all threads (count, total, min, mean, p99, max; self is total minus children)\n";
+        out << "--------------------------------------------\n";
+
+        for (int child : merged.nodes[0].children)
+        {
+            Print(out, merged, child, 0);
+        }
+
+        out << "--------------------------------------------\n";
+        out << "Time in top level scopes per thread\n";
+        out << "--------------------------------------------\n";
+
+        for (auto const& thread : threads)
+        {
+            std::int64_t total = 0;
+
+            for (int child : thread->nodes[0].children)
+            {
+                total += thread->nodes[child].total;
+            }
+
+            out << std::setw(12) << thread->name << ": " << Format(total) << '\n';
+        }
+
+        if (!merged.slowest.empty())
+        {
+            out << "--------------------------------------------\n";
+            out << "Slowest runs\n";
+            out << "--------------------------------------------\n";
+
+            for (auto const& [nanoseconds, item] : merged.slowest)
+            {
+                out << std::setw(12) << Format(nanoseconds) << ": " << item << '\n';
+            }
+        }
+
+        out << "--------------------------------------------\n";
+    }
+
+    void WriteJSON(std::string const& path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        std::ofstream out(path);
+        ThreadProfile merged = Merged();
+
+        out << "{\n  \"merged\": ";
+        JSON(out, merged, 0, 2);
+        out << ",\n  \"slowest\": [";
+
+        for (std::size_t item = 0; item < merged.slowest.size(); item++)
+        {
+            out << (item ? ",\n    " : "\n    ") << "{\"name\": \"" << merged.slowest[item].second
+                << "\", \"time\": " << merged.slowest[item].first * 1e-9 << "}";
+        }
+
+        out << (merged.slowest.empty() ? "]" : "\n  ]") << ",\n  \"threads\": [";
+
+        for (std::size_t thread = 0; thread < threads.size(); thread++)
+        {
+            out << (thread ? ",\n    " : "\n    ") << "{\"name\": \"" << threads[thread]->name << "\", \"scopes\": ";
+            JSON(out, *threads[thread], 0, 6);
+            out << "}";
+        }
+
+        out << "\n  ]\n}\n";
+    }
+
+  private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadProfile>> threads;
+
+    // Highest set bit picks the octave, the three bits below it the step within the octave
+    static inline int Bucket(std::int64_t nanoseconds)
+    {
+        if (nanoseconds < subBuckets)
+            return 0;
+
+        int octave = 63 - __builtin_clzll(nanoseconds);
+        int step = (nanoseconds >> (octave - 3)) & (subBuckets - 1);
+
+        return std::min(octave * subBuckets + step, octaves * subBuckets - 1);
+    }
+
+    static std::int64_t BucketEdge(std::size_t bucket)
+    {
+        if (bucket <= 3 * subBuckets)
+            return subBuckets;
+
+        return std::int64_t(subBuckets + bucket % subBuckets) << (bucket / subBuckets - 3);
+    }
+
+    static void MergeInto(ThreadProfile& merged, int mergedNode, ThreadProfile const& thread, int threadNode)
+    {
+        merged.nodes[mergedNode].Add(thread.nodes[threadNode]);
+
+        for (int child : thread.nodes[threadNode].children)
+        {
+            int mergedChild = merged.Child(mergedNode, thread.nodes[child].name);
+            MergeInto(merged, mergedChild, thread, child);
+        }
+    }
+
+    ThreadProfile Merged() const
+    {
+        ThreadProfile merged;
+
+        for (auto const& thread : threads)
+        {
+            MergeInto(merged, 0, *thread, 0);
+
+            for (auto const& [nanoseconds, item] : thread->slowest)
+            {
+                merged.KeepSlowest(nanoseconds, item);
+            }
+        }
+
+        return merged;
+    }
+
+    static std::string Format(std::int64_t nanoseconds)
+    {
+        double seconds = nanoseconds * 1e-9;
+        std::ostringstream text;
+        text << std::setprecision(3);
+
+        if (seconds >= 1)
+            text << seconds << " s";
+        else if (seconds >= 1e-3)
+            text << seconds * 1e3 << " ms";
+        else
+            text << seconds * 1e6 << " us";
+
+        return text.str();
+    }
+
+    static void Print(std::ostream& out, ThreadProfile const& profile, int index, int depth)
+    {
+        Node const& node = profile.nodes[index];
+        std::int64_t childTotal = 0;
+
+        for (int child : node.children)
+        {
+            childTotal += profile.nodes[child].total;
+        }
+
+        out << std::string(2 * depth, ' ') << node.name << ": " << node.count << "x, " << Format(node.total);
+
+        // Phase timers estimate their children from a sample, so they can add up to a little more than the parent
+        if (!node.children.empty())
+            out << " (self " << Format(std::max<std::int64_t>(0, node.total - childTotal)) << ")";
+
+        out << ", min " << Format(node.min) << ", mean " << Format(node.total / node.count) << ", p99 "
+            << Format(node.P99()) << ", max " << Format(node.max) << '\n';
+
+        for (int child : node.children)
+        {
+            Print(out, profile, child, depth + 1);
+        }
+    }
+
+    static void JSON(std::ostream& out, ThreadProfile const& profile, int index, int indent)
+    {
+        Node const& node = profile.nodes[index];
+
+        out << "{";
+
+        if (index > 0)
+        {
+            // Seconds, like the printed report's largest unit
+            out << "\"name\": \"" << node.name << "\", \"count\": " << node.count << ", \"total\": " << node.total * 1e-9
+                << ", \"min\": " << node.min * 1e-9 << ", \"mean\": " << node.total * 1e-9 / node.count
+                << ", \"p99\": " << node.P99() * 1e-9 << ", \"max\": " << node.max * 1e-9 << ", ";
+        }
+
+        out << "\"children\": [";
+
+        for (std::size_t child = 0; child < node.children.size(); child++)
+        {
+            out << (child ? ",\n" : "\n") << std::string(indent + 2, ' ');
+            JSON(out, profile, node.children[child], indent + 2);
+        }
+
+        out << (node.children.empty() ? "" : "\n" + std::string(indent, ' ')) << "]}";
+    }
+};
+
+// Times from construction until Close or destruction, under whichever scope is open on this thread
+class ProfileScope
+{
+  public:
+    explicit ProfileScope(char const* name)
+    {
+        if (!Profiler::enabled)
+            return;
+
+        profile = &Profiler::Get().Thread();
+        parent = profile->current;
+        node = profile->Child(parent, name);
+        profile->current = node;
+        start = std::chrono::steady_clock::now();
+    }
+
+    ~ProfileScope() { Close(); }
+
+    ProfileScope(ProfileScope const&) = delete;
+    ProfileScope& operator=(ProfileScope const&) = delete;
+
+    // Returns the time recorded, 0 if nothing was
+    std::int64_t Close()
+    {
+        if (!profile)
+            return 0;
+
+        auto duration = std::chrono::steady_clock::now() - start;
+        std::int64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+
+        profile->nodes[node].Add(nanoseconds);
+        profile->current = parent;
+        profile = nullptr;
+
+        return nanoseconds;
+    }
+
+  private:
+    Profiler::ThreadProfile* profile = nullptr;
+    int node = 0, parent = 0;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Splits the time of a hot loop into phases without a scope per iteration. One iteration in sampleEvery is timed, the
+// clock is read where the loop moves from one phase to the next, and Close() adds the scaled up totals once, as
+// children of the scope open on this thread. Phases are indices into the names given to the constructor.
+class PhaseTimer
+{
+  public:
+    static constexpr long sampleEvery = 16;
+
+    explicit PhaseTimer(std::vector<char const*> names) : names(std::move(names)), totals(this->names.size()) {}
+
+    ~PhaseTimer() { Close(); }
+
+    PhaseTimer(PhaseTimer const&) = delete;
+    PhaseTimer& operator=(PhaseTimer const&) = delete;
+
+    // Start of iteration, which runs in the first phase until Switch
+    inline void Begin(long iteration)
+    {
+        if (sampling)
+            Attribute();
+
+        sampling = Profiler::enabled && iteration % sampleEvery == 0;
+
+        if (sampling)
+        {
+            phase = 0;
+            mark = std::chrono::steady_clock::now();
+        }
+    }
+
+    // The time since the last switch goes to the current phase, from here on it goes to next
+    inline void Switch(int next)
+    {
+        if (!sampling)
+            return;
+
+        Attribute();
+        phase = next;
+    }
+
+    void Close()
+    {
+        if (sampling)
+            Attribute();
+
+        sampling = false;
+
+        if (!Profiler::enabled || recorded)
+            return;
+
+        Profiler::ThreadProfile& profile = Profiler::Get().Thread();
+
+        for (std::size_t index = 0; index < names.size(); index++)
+        {
+            profile.nodes[profile.Child(profile.current, names[index])].Add(totals[index] * sampleEvery);
+        }
+
+        recorded = true;
+    }
+
+  private:
+    std::vector<char const*> names;
+    std::vector<std::int64_t> totals;
+    std::chrono::steady_clock::time_point mark;
+    int phase = 0;
+    bool sampling = false, recorded = false;
+
+    inline void Attribute()
+    {
+        auto now = std::chrono::steady_clock::now();
+        totals[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - mark).count();
+        mark = now;
+    }
+};
+
+// Total run time of main. With profiling on it's also the root scope, and the report is printed when it ends
 struct Timer
 {
     std::chrono::_V2::system_clock::time_point start, end;
     std::chrono::duration<float> duration;
+    ProfileScope scope{"BiPo"};
+    std::string jsonPath;
 
-    Timer() { start = std::chrono::high_resolution_clock::now(); }
+    Timer(std::string const& jsonPath = "") : jsonPath(jsonPath) { start = std::chrono::high_resolution_clock::now(); }
 
     ~Timer()
     {
@@ -20,7 +489,16 @@ struct Timer
         float ms = duration.count() * 1000.0f;
 
         std::clog << "Duration: " << ms << "ms.\n";
+
+        if (!Profiler::enabled)
+            return;
+
+        scope.Close();
+        Profiler::Get().Report(std::clog);
+
+        if (!jsonPath.empty())
+            Profiler::Get().WriteJSON(jsonPath);
     }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,389 @@
+#ifndef TOYMC_H
+#define TOYMC_H
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "FixedHistogram.h"
+#include "Unbiasing.h"
+
+// Toy Monte Carlo for the unbiasing estimator. Every toy draws the correlated and the accidental counts of the five
+// bins from Poisson distributions around the expected rates, subtracts the accidentals with the n2f weight like
+// SubtractBackgrounds does, and runs UnbiasedMean on the result. The pull (p - true p) / pError of every toy is kept,
+// so a pull width of one and 68.3 % of the toys within one sigma mean the propagated error covers.
+//
+// Toys are thrown in chunks with their own random stream, so the pulls only depend on the seed and not on how many
+// threads threw them.
+
+// xoshiro256+ run in lanes. Each lane is its own generator and all eight are stepped together, a block of uniforms at a
+// time: with AVX2, as two registers of four lanes, when the CPU has it and one lane at a time otherwise. Compilers
+// don't vectorize the scalar loop on their own (64 bit shifts and rotates over eight lanes aren't worth it to them), so
+// the AVX2 step is written out. Both give the same numbers, so the toys don't depend on the machine
+class LaneRandom
+{
+  public:
+    explicit LaneRandom(std::uint64_t seed)
+    {
+        // splitmix64 spreads the seed over the lanes
+        for (int word = 0; word < 4; word++)
+        {
+            for (int lane = 0; lane < lanes; lane++)
+            {
+                seed += 0x9e3779b97f4a7c15ull;
+                std::uint64_t z = seed;
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                state[word][lane] = z ^ (z >> 31);
+            }
+        }
+    }
+
+    // Uniform in [0, 1)
+    inline double Uniform()
+    {
+        if (position == block)
+            Refill();
+
+        return buffer[position++];
+    }
+
+    static constexpr int lanes = 8;
+    static constexpr int block = 32 * lanes;
+
+    // The next block of uniforms, one step of every lane per eight of them. Uniform() picks one of the two, both are
+    // public so the tests can check they agree
+    void RefillScalar()
+    {
+        auto& s0 = state[0];
+        auto& s1 = state[1];
+        auto& s2 = state[2];
+        auto& s3 = state[3];
+
+        for (int step = 0; step < block; step += lanes)
+        {
+            for (int lane = 0; lane < lanes; lane++)
+            {
+                std::uint64_t result = s0[lane] + s3[lane];
+                std::uint64_t t = s1[lane] << 17;
+
+                s2[lane] ^= s0[lane];
+                s3[lane] ^= s1[lane];
+                s1[lane] ^= s2[lane];
+                s0[lane] ^= s3[lane];
+                s2[lane] ^= t;
+                s3[lane] = (s3[lane] << 45) | (s3[lane] >> 19);
+
+                buffer[step + lane] = (result >> 11) * 0x1.0p-53;
+            }
+        }
+
+        position = 0;
+    }
+
+    // Four lanes per register. AVX2 has no 64 bit integer to double conversion, so the top 53 bits are split in two
+    // halves that each fit a double's mantissa, converted exactly with the 2^52 bias and put back together, which gives
+    // the same double as the scalar conversion
+    __attribute__((target("avx2"))) void RefillAVX2()
+    {
+        static_assert(lanes == 8, "two registers of four lanes");
+
+        __m256i s[4][2];
+
+        for (int word = 0; word < 4; word++)
+        {
+            for (int half = 0; half < 2; half++)
+            {
+                s[word][half] = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(&state[word][4 * half]));
+            }
+        }
+
+        __m256i const lowMask = _mm256_set1_epi64x(0xFFFFFFFFll);
+        __m256i const biasBits = _mm256_set1_epi64x(0x4330000000000000ll);
+        __m256d const bias = _mm256_set1_pd(0x1.0p52), high = _mm256_set1_pd(0x1.0p32), scale = _mm256_set1_pd(0x1.0p-53);
+
+        for (int step = 0; step < block; step += lanes)
+        {
+            for (int half = 0; half < 2; half++)
+            {
+                __m256i& s0 = s[0][half];
+                __m256i& s1 = s[1][half];
+                __m256i& s2 = s[2][half];
+                __m256i& s3 = s[3][half];
+
+                __m256i result = _mm256_srli_epi64(_mm256_add_epi64(s0, s3), 11);
+                __m256i t = _mm256_slli_epi64(s1, 17);
+
+                s2 = _mm256_xor_si256(s2, s0);
+                s3 = _mm256_xor_si256(s3, s1);
+                s1 = _mm256_xor_si256(s1, s2);
+                s0 = _mm256_xor_si256(s0, s3);
+                s2 = _mm256_xor_si256(s2, t);
+                s3 = _mm256_or_si256(_mm256_slli_epi64(s3, 45), _mm256_srli_epi64(s3, 19));
+
+                __m256d upper = _mm256_sub_pd(
+                    _mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(result, 32), biasBits)), bias);
+                __m256d lower
+                    = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(result, lowMask), biasBits)), bias);
+
+                // Both products and the sum are exact, the value has at most 53 bits
+                __m256d uniform = _mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(upper, high), lower), scale);
+                _mm256_storeu_pd(&buffer[step + 4 * half], uniform);
+            }
+        }
+
+        for (int word = 0; word < 4; word++)
+        {
+            for (int half = 0; half < 2; half++)
+            {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(&state[word][4 * half]), s[word][half]);
+            }
+        }
+
+        position = 0;
+    }
+
+  private:
+    std::array<std::array<std::uint64_t, lanes>, 4> state;
+    std::array<double, block> buffer;
+    int position = block;
+
+    void Refill()
+    {
+        static bool const hasAVX2 = __builtin_cpu_supports("avx2");
+
+        if (hasAVX2)
+            RefillAVX2();
+        else
+            RefillScalar();
+    }
+};
+
+// log(k!), from a table for small k and Stirling's series above it. std::lgamma writes the global signgam, this
+// doesn't
+inline double LogFactorial(long long k)
+{
+    static std::array<double, 256> const table = []()
+    {
+        std::array<double, 256> logs{};
+
+        for (int i = 2; i < 256; i++)
+        {
+            logs[i] = logs[i - 1] + std::log(double(i));
+        }
+
+        return logs;
+    }();
+
+    if (k < 256)
+        return table[k];
+
+    double x = k, inverse = 1 / x, inverse2 = inverse * inverse;
+
+    return (x + 0.5) * std::log(x) - x + 0.91893853320467274 + inverse * (1.0 / 12 - inverse2 * (1.0 / 360 - inverse2 / 1260));
+}
+
+// Poisson draws with a fixed mean. Small means multiply uniforms until they drop below exp(-mean), large ones use
+// Hörmann's transformed rejection (PTRS), which takes about one pair of uniforms per draw whatever the mean
+class PoissonSampler
+{
+  public:
+    explicit PoissonSampler(double mean) : mean(mean)
+    {
+        expMinusMean = std::exp(-mean);
+
+        if (mean < 10)
+            return;
+
+        logMean = std::log(mean);
+        b = 0.931 + 2.53 * std::sqrt(mean);
+        a = -0.059 + 0.02483 * b;
+        logInverseAlpha = std::log(1.1239 + 1.1328 / (b - 3.4));
+        vr = 0.9277 - 3.6224 / (b - 2);
+    }
+
+    inline long long operator()(LaneRandom& random) const
+    {
+        if (mean <= 0)
+            return 0;
+
+        if (mean < 10)
+        {
+            long long k = 0;
+            double product = random.Uniform();
+
+            while (product > expMinusMean)
+            {
+                k++;
+                product *= random.Uniform();
+            }
+
+            return k;
+        }
+
+        while (true)
+        {
+            double u = random.Uniform() - 0.5;
+            double v = random.Uniform();
+            double us = 0.5 - std::fabs(u);
+            long long k = std::floor((2 * a / us + b) * u + mean + 0.43);
+
+            if (us >= 0.07 && v <= vr)
+                return k;
+
+            if (k < 0 || (us < 0.013 && v > us))
+                continue;
+
+            if (std::log(v) + logInverseAlpha - std::log(a / (us * us) + b) <= -mean + k * logMean - LogFactorial(k))
+                return k;
+        }
+    }
+
+  private:
+    double mean;
+    double expMinusMean = 0;
+    double logMean = 0, a = 0, b = 0, logInverseAlpha = 0, vr = 0;
+};
+
+// Expected counts of the five bins for one direction, correlated and accidental (before the n2f weight)
+struct ToyRates
+{
+    std::array<double, UnbiasingBinSize> correlated{};
+    std::array<double, UnbiasingBinSize> accidental{};
+    double n2f = 1;
+    double segmentWidth = 1;
+};
+
+struct PullAxis
+{
+    static constexpr int bins = 200;
+    static constexpr double min = -5, max = 5;
+};
+
+struct ToyResult
+{
+    FixedHistogram<PullAxis> pulls;
+    long long toys = 0, failed = 0;  // Failed toys gave no finite p or error, e.g. an empty denominator
+    long long withinOne = 0, withinTwo = 0;
+    double pullSum = 0, pullSquares = 0;
+
+    void Add(ToyResult const& other)
+    {
+        pulls.Add(other.pulls);
+        toys += other.toys;
+        failed += other.failed;
+        withinOne += other.withinOne;
+        withinTwo += other.withinTwo;
+        pullSum += other.pullSum;
+        pullSquares += other.pullSquares;
+    }
+
+    double PullMean() const { return Used() > 0 ? pullSum / Used() : 0; }
+    double PullWidth() const { return Used() > 1 ? std::sqrt(pullSquares / Used() - PullMean() * PullMean()) : 0; }
+    long long Used() const { return toys - failed; }
+};
+
+// The true p is what the estimator gives for the expected counts themselves
+inline double TrueUnbiasedMean(ToyRates const& rates)
+{
+    UnbiasingCounts expected;
+
+    for (int bin = BinPlus; bin < UnbiasingBinSize; bin++)
+    {
+        expected.n[bin] = rates.correlated[bin] - rates.n2f * rates.accidental[bin];
+    }
+
+    double p, pError;
+    UnbiasedMean(expected, rates.segmentWidth, p, pError);
+
+    return p;
+}
+
+// Throws the toys on several threads, one chunk of toys at a time
+inline ToyResult ThrowToys(ToyRates const& rates, long long toys, int threads, std::uint64_t seed)
+{
+    constexpr long long chunkSize = 1 << 16;
+
+    long long chunks = (toys + chunkSize - 1) / chunkSize;
+    double truth = TrueUnbiasedMean(rates);
+
+    std::array<PoissonSampler, UnbiasingBinSize * 2> samplers = {
+        PoissonSampler(rates.correlated[0]), PoissonSampler(rates.correlated[1]), PoissonSampler(rates.correlated[2]),
+        PoissonSampler(rates.correlated[3]), PoissonSampler(rates.correlated[4]), PoissonSampler(rates.accidental[0]),
+        PoissonSampler(rates.accidental[1]), PoissonSampler(rates.accidental[2]), PoissonSampler(rates.accidental[3]),
+        PoissonSampler(rates.accidental[4])};
+
+    // Every chunk keeps its own result, added in chunk order at the end
+    std::vector<ToyResult> chunkResults(chunks);
+    std::atomic<long long> next = 0;
+    std::vector<std::thread> pool;
+
+    for (int thread = 0; thread < std::max(1, std::min<int>(threads, chunks)); thread++)
+    {
+        pool.emplace_back(
+            [&]()
+            {
+                for (long long chunk = next++; chunk < chunks; chunk = next++)
+                {
+                    LaneRandom random(seed * 0x100000001b3ull + chunk);
+                    ToyResult& result = chunkResults[chunk];
+                    long long count = std::min(chunkSize, toys - chunk * chunkSize);
+
+                    for (long long toy = 0; toy < count; toy++)
+                    {
+                        UnbiasingCounts drawn;
+
+                        for (int bin = BinPlus; bin < UnbiasingBinSize; bin++)
+                        {
+                            double correlated = samplers[bin](random);
+                            double accidental = samplers[UnbiasingBinSize + bin](random);
+
+                            // Same content and error the subtracted histogram bin gets
+                            drawn.n[bin] = correlated - rates.n2f * accidental;
+                            drawn.error[bin] = std::sqrt(correlated + rates.n2f * rates.n2f * accidental);
+                        }
+
+                        double p, pError;
+                        UnbiasedMean(drawn, rates.segmentWidth, p, pError);
+
+                        result.toys++;
+                        double pull = (p - truth) / pError;
+
+                        if (!std::isfinite(pull))
+                        {
+                            result.failed++;
+                            continue;
+                        }
+
+                        result.pulls.Fill(pull);
+                        result.pullSum += pull;
+                        result.pullSquares += pull * pull;
+                        result.withinOne += (std::fabs(pull) < 1);
+                        result.withinTwo += (std::fabs(pull) < 2);
+                    }
+                }
+            });
+    }
+
+    for (auto& thread : pool)
+    {
+        thread.join();
+    }
+
+    ToyResult total;
+
+    for (ToyResult const& result : chunkResults)
+    {
+        total.Add(result);
+    }
+
+    return total;
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef UNBIASING_H
+#define UNBIASING_H
+
+#include <array>
+#include <cmath>
+
+// The five bins BiPo::CalculateUnbiasing reads for one direction: beta in the positive and negative neighbour (N+,
+// N-), and same segment alphas with only the positive, only the negative or both neighbours live (N++, N--, N+-)
+enum UnbiasingBins
+{
+    BinPlus = 0,
+    BinMinus,
+    BinPlusPlus,
+    BinMinusMinus,
+    BinPlusMinus,
+    UnbiasingBinSize
+};
+
+struct UnbiasingCounts
+{
+    std::array<double, UnbiasingBinSize> n{};
+    std::array<double, UnbiasingBinSize> error{};
+};
+
+// Unbiased mean displacement and its propagated error. Check the error propagation technote for details on the method
+inline void UnbiasedMean(UnbiasingCounts const& counts, double segmentWidth, double& p, double& pError)
+{
+    double nPlus = counts.n[BinPlus], nMinus = counts.n[BinMinus];
+    double nPlusPlus = counts.n[BinPlusPlus], nMinusMinus = counts.n[BinMinusMinus];
+    double nPlusMinus = counts.n[BinPlusMinus];
+
+    double nPlusError = counts.error[BinPlus], nMinusError = counts.error[BinMinus];
+    double nPlusPlusError = counts.error[BinPlusPlus], nMinusMinusError = counts.error[BinMinusMinus];
+    double nPlusMinusError = counts.error[BinPlusMinus];
+
+    double rPlus = nPlus / (nPlusPlus + nPlusMinus);
+    double rMinus = nMinus / (nMinusMinus + nPlusMinus);
+
+    p = segmentWidth * (rPlus - rMinus) / (rPlus + rMinus + 1);
+
+    pError
+        = segmentWidth
+          * pow(1 / ((nMinus * (nPlusMinus + nPlusPlus) + (nMinusMinus + nPlusMinus) * (nPlus + nPlusMinus + nPlusPlus))), 2)
+          * sqrt(pow((nMinusMinus + nPlusMinus) * (nPlusMinus + nPlusPlus), 2)
+                     * (pow(nPlusError * (2 * nMinus + nMinusMinus + nPlusMinus), 2)
+                        + pow(nMinusError * (2 * nPlus + nPlusPlus + nPlusMinus), 2))
+                 + pow((nPlus * (nPlusMinus + nMinusMinus) * (2 * nMinus + nMinusMinus + nPlusMinus) * nPlusPlusError), 2)
+                 + pow((nPlusMinusError
+                        * (nPlus * pow((nMinusMinus + nPlusMinus), 2)
+                           + nMinus * (2 * nMinusMinus * nPlus - 2 * nPlus * nPlusPlus - pow((nPlusMinus + nPlusPlus), 2)))),
+                       2)
+                 + pow((nMinus * (nPlusMinus + nPlusPlus) * (2 * nPlus + nPlusMinus + nPlusPlus) * nMinusMinusError), 2));
+}
+
+#endif
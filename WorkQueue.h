@@ -0,0 +1,146 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <numeric>
+#include <vector>
+
+// Hands out run indices to a fixed set of workers. Runs are dealt round-robin, largest first, into one deque per
+// worker. A worker takes from the front of its own deque and, once that's empty, steals from the back of the fullest
+// other deque, so the small runs left at the end are what get moved around.
+class WorkQueue
+{
+  public:
+    WorkQueue(std::vector<std::size_t> const& costs, int workers) : queues(workers), locks(workers)
+    {
+        std::vector<std::size_t> order(costs.size());
+        std::iota(order.begin(), order.end(), 0);
+
+        // Largest first, file list order for ties
+        std::stable_sort(order.begin(), order.end(), [&costs](std::size_t a, std::size_t b) { return costs[a] > costs[b]; });
+
+        for (std::size_t i = 0; i < order.size(); i++)
+        {
+            queues[i % workers].push_back(order[i]);
+        }
+    }
+
+    // Returns false once every deque is empty
+    bool Pop(int worker, std::size_t& task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(locks[worker]);
+
+            if (!queues[worker].empty())
+            {
+                task = queues[worker].front();
+                queues[worker].pop_front();
+                return true;
+            }
+        }
+
+        return Steal(worker, task);
+    }
+
+    int Steals() const { return steals; }
+
+  private:
+    std::vector<std::deque<std::size_t>> queues;
+    std::vector<std::mutex> locks;
+    int steals = 0;
+    std::mutex stealLock;
+
+    bool Steal(int thief, std::size_t& task)
+    {
+        std::lock_guard<std::mutex> guard(stealLock);
+
+        while (true)
+        {
+            // Picking the victim with the most runs left
+            int victim = -1;
+            std::size_t most = 0;
+
+            for (int worker = 0; worker < (int)queues.size(); worker++)
+            {
+                if (worker == thief)
+                    continue;
+
+                std::lock_guard<std::mutex> lock(locks[worker]);
+
+                if (queues[worker].size() > most)
+                {
+                    most = queues[worker].size();
+                    victim = worker;
+                }
+            }
+
+            if (victim < 0)
+                return false;
+
+            std::lock_guard<std::mutex> lock(locks[victim]);
+
+            // The victim may have drained its deque since we looked
+            if (queues[victim].empty())
+                continue;
+
+            task = queues[victim].back();
+            queues[victim].pop_back();
+            steals++;
+
+            return true;
+        }
+    }
+};
+
+// Fixed depth queue between one producer and one consumer. Push blocks while the queue is full, Pop blocks while it's
+// empty and returns false once the producer has closed the queue and everything in it has been taken.
+template <typename T>
+class BoundedQueue
+{
+  public:
+    explicit BoundedQueue(std::size_t depth) : depth(std::max<std::size_t>(depth, 1)) {}
+
+    void Push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this]() { return items.size() < depth; });
+
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    bool Pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this]() { return !items.empty() || closed; });
+
+        if (items.empty())
+            return false;
+
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+
+        return true;
+    }
+
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+  private:
+    std::size_t depth;
+    std::deque<T> items;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable notFull, notEmpty;
+};
+
+#endif